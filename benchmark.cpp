@@ -0,0 +1,127 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include "matrix.h"
+#include "matrixLU.h"
+#include "benchmark.h"
+
+namespace {
+
+typedef std::chrono::steady_clock benchClock;
+
+//Each measurement is the best of this many runs
+const int repeats = 3;
+
+template <class Type>
+Matrix::matrix<Type> randomMatrix(int dim, unsigned seed){
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> value(-1.0, 1.0);
+    Matrix::matrix<Type> output(dim, dim);
+    for (int y = 0; y < dim; y++){
+        for (int x = 0; x < dim; x++){
+            //A heavy diagonal keeps the matrix well conditioned, so the two paths can be compared
+            output(y, x) = static_cast<Type>(value(generator) + ((x == y) ? dim : 0));
+        }
+    }
+    return output;
+}
+
+template <class Type>
+double largestDifference(const Matrix::matrix<Type> &a, const Matrix::matrix<Type> &b){
+    double output = 0;
+    for (int y = 0; y < a.getHeight(); y++){
+        for (int x = 0; x < a.getWidth(); x++){
+            output = std::max(output, std::fabs(static_cast<double>(a(y, x)) - static_cast<double>(b(y, x))));
+        }
+    }
+    return output;
+}
+
+//Best time in milliseconds of running operation with the backend switched on or off
+template <class Result>
+double timeIt(bool useBlas, const std::function<Result()> &operation, Result &result){
+    Matrix::blas::setEnabled(useBlas);
+    double best = 0;
+    for (int r = 0; r < repeats; r++){
+        benchClock::time_point began = benchClock::now();
+        result = operation();
+        double ms = std::chrono::duration<double, std::milli>(benchClock::now() - began).count();
+        if (r == 0 || ms < best){
+            best = ms;
+        }
+    }
+    return best;
+}
+
+//A negative time is an operation that was not run
+void report(const std::string &name, double native, double blas, double difference){
+    std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3);
+    if (native >= 0){
+        std::cout << std::setw(12) << native;
+    } else {
+        std::cout << std::setw(12) << "skipped";
+    }
+    if (blas >= 0){
+        std::cout << std::setw(12) << blas;
+    }
+    if (native >= 0 && blas >= 0){
+        std::cout << std::setw(10) << std::setprecision(2) << native / blas
+            << std::setw(12) << std::scientific << difference;
+    }
+    std::cout << std::defaultfloat << '\n';
+}
+
+template <class Result>
+void compare(const std::string &name, const std::function<Result()> &operation, bool nativeToo){
+    Result native, blas;
+    double nativeMs = nativeToo ? timeIt(false, operation, native) : -1;
+    double blasMs = Matrix::blas::available() ? timeIt(true, operation, blas) : -1;
+    double difference = (nativeMs >= 0 && blasMs >= 0) ? largestDifference(native, blas) : 0;
+    report(name, nativeMs, blasMs, difference);
+}
+
+//Scalar results are compared as 1x1 matrices
+Matrix::matrix<double> scalar(double value){
+    Matrix::matrix<double> output(1, 1);
+    output(0, 0) = value;
+    return output;
+}
+
+}
+
+int runBenchmark(int dim){
+    const bool enabled = Matrix::blas::enabledFlag();
+    Matrix::matrix<double> A = randomMatrix<double>(dim, 1);
+    Matrix::matrix<double> B = randomMatrix<double>(dim, 2);
+    Matrix::matrix<float> F = randomMatrix<float>(dim, 3);
+    Matrix::matrix<float> G = randomMatrix<float>(dim, 4);
+
+    std::cout << "dimension " << dim << ", best of " << repeats << " runs, times in ms\n";
+    if (!Matrix::blas::available()){
+        std::cout << "built without a BLAS backend (make blas), timing the native path only\n";
+    }
+    std::cout << std::left << std::setw(20) << "operation" << std::right << std::setw(12) << "native";
+    if (Matrix::blas::available()){
+        std::cout << std::setw(12) << "blas" << std::setw(10) << "speedup" << std::setw(12) << "max diff";
+    }
+    std::cout << '\n';
+
+    compare<Matrix::matrix<double> >("multiply double", [&]{ return A * B; }, true);
+    compare<Matrix::matrix<float> >("multiply float", [&]{ return F * G; }, true);
+    compare<Matrix::matrix<double> >("transpose double", [&]{ return Matrix::transpose(A); }, true);
+    compare<Matrix::matrix<double> >("lu solve", [&]{ return Matrix::luDecomposition(A).solve(B); }, true);
+    compare<Matrix::matrix<double> >("determinant", [&]{ return scalar(Matrix::determinant(A, 0)); }, true);
+    compare<Matrix::matrix<double> >("invert", [&]{ return Matrix::invert(A); }, true);
+
+    Matrix::blas::setEnabled(enabled);
+    std::cout.flush();
+    return 0;
+}
@@ -0,0 +1,16 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/*
+Time the native kernels against the BLAS/LAPACK backend on the same random dim*dim inputs, and
+report both times with the largest difference between their results.
+Operations whose native version uses cofactor expansion are only timed natively for small dim.
+Returns the process exit code.
+*/
+int runBenchmark(int dim);
+
+#endif
@@ -12,9 +12,19 @@ Written by Andrew M. Hall
 #include <string>
 #include <cstring>
 #include "matrix.h"
+#include "matrixTiled.h"
+#include "matrixQR.h"
+#include "matrixExact.h"
+#include "server.h"
+#include "pipeline.h"
+#include "benchmark.h"
+#ifdef MATRIX_USE_MPI
+#include "matrixMPI.h"
+#endif
 
 const int defaultPrecision = 3;
-const int numArgs = 5;
+const int defaultCacheEntries = 32;
+const int numArgs = 15;
 
 //Codes used to identify command line options, also used as keys for ArgMap
 enum ArgCode{
@@ -22,7 +32,17 @@ enum ArgCode{
     INPUT,
     OUTPUT,
     PRECISION,
-    HELP
+    HELP,
+    SERVE,
+    CACHE,
+    COUNT,
+    STATS,
+    SCRATCH,
+    BENCHMARK,
+    PINV,
+    WIDTH,
+    HEIGHT,
+    EXACT
 };
 
 //Hold data about arguments, used to dynamically create help message and parse arguments from command line
@@ -32,14 +52,25 @@ struct Argument{
     const char* description;
     ArgCode code;
     bool mandatory;
-    Argument(const char* l, const char* s, const char* d, ArgCode c, bool m):
-        longCode(l), shortCode(s), description(d), code(c), mandatory(m){};
+    bool takesValue;
+    Argument(const char* l, const char* s, const char* d, ArgCode c, bool m, bool v = true):
+        longCode(l), shortCode(s), description(d), code(c), mandatory(m), takesValue(v){};
 }   arguments[numArgs] {
 Argument("--dimension", "-d", "The dimension, n, of the input nxn matrix", DIMENSION, true),
 Argument("--input", "-i", "The name of the input file that contains the matrix to be inverted",INPUT, true),
 Argument("--output", "-o", "The name of a file, which the inverted matrix will be written to", OUTPUT, false),
 Argument("--precision", "-p", "The precision (number of decimal places) which the inverted matrix will be displayed (default 3)", PRECISION, false),
-Argument("--help", "-h", "Display help message", HELP, false)
+Argument("--help", "-h", "Display help message", HELP, false, false),
+Argument("--serve", "-s", "Run as a server instead of inverting one file, reading requests from stdin (-) or the Unix socket at the given path", SERVE, false),
+Argument("--cache", "-c", "The number of factorizations a server keeps for repeated matrices (default 32)", CACHE, false),
+Argument("--count", "-n", "The number of matrices to read back to back from the input file, 0 for all of them (default 1)", COUNT, false),
+Argument("--stats", "-t", "Print the time spent in each stage of the run, and the structure found in the matrices, to stderr", STATS, false, false),
+Argument("--scratch", "-x", "Invert out of core, keeping the matrix in tiles in a scratch file in the given directory, for matrices larger than memory", SCRATCH, false),
+Argument("--benchmark", "-b", "Time the native and BLAS versions of each operation on random matrices of the given dimension, instead of inverting a file", BENCHMARK, false, false),
+Argument("--pinv", "-g", "Find the pseudo-inverse of a rectangular matrix by QR, sized by -d, or -w and -e", PINV, false, false),
+Argument("--width", "-w", "The width (number of columns) of the input matrix for --pinv", WIDTH, false),
+Argument("--height", "-e", "The height (number of rows) of the input matrix for --pinv", HEIGHT, false),
+Argument("--exact", "-r", "Invert an integer matrix exactly, writing the inverse as 1/d times an integer matrix", EXACT, false, false)
 };
 
 //Map used to hold ArgCodes/Value pairs
@@ -47,34 +78,86 @@ typedef std::map<ArgCode, std::string> argMap;
 
 //Helper functions
 bool setPrec(std::ostream &out, const std::string &str);
+bool parseSize(const std::string &str, const char* name, int minimum, int &size);
+void pseudoInvert(std::istream &input, std::ostream &output, int width, int height);
+void invertExactly(std::istream &input, std::ostream &output, int dim);
+void invertOutOfCore(std::istream &input, std::ostream &output, int dim, const std::string &scratch);
 inline bool argGiven(const argMap &m, ArgCode a);
 std::string getHelpMessage(const char* name);
+int run(int argc, char *argv[]);
+#ifdef MATRIX_USE_MPI
+int invertDistributed(const std::string &input, const std::string &output, int precision, int dim);
+#endif
 
 int main(int argc, char *argv[])
+{
+#ifdef MATRIX_USE_MPI
+    MPI_Init(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    //Every rank parses the same command line, but only the root talks to the user
+    if (rank != 0){
+        std::cout.setstate(std::ios::badbit);
+    }
+    int result = run(argc, argv);
+    MPI_Finalize();
+    return result;
+#else
+    return run(argc, argv);
+#endif
+}
+
+int run(int argc, char *argv[])
 {
     //Place all command line arguments into argument map using Argument as key
     argMap inputArguments;
     std::string helpMessage = getHelpMessage(argv[0]);
     //Iterate through command line arguments
-    for (int i = 1; i < argc; i+=2){
-        //Deal with --help flag being the
-        if (i+1 == argc && strcmp(argv[i], arguments[HELP].shortCode) && strcmp(argv[i], arguments[HELP].longCode)){
+    for (int i = 1; i < argc; i++){
+        int a = 0;
+        while (a < numArgs && strcmp(argv[i], arguments[a].longCode) && strcmp(argv[i], arguments[a].shortCode)){
+            a++;
+        }
+        //Unknown arguments, and arguments missing their value, are both mismatches
+        if (a == numArgs || (arguments[a].takesValue && i+1 == argc)){
             std::cout << "Incorrect command line arguments, mismatch on " << argv[i] << std::endl;
             return 0;
         }
-        for (int a = 0; a < numArgs; a++){
-            if (!strcmp(argv[i], arguments[a].longCode) || !strcmp(argv[i], arguments[a].shortCode)){
-                if (arguments[a].code == HELP){
-                    std::cout << helpMessage << std::endl;
-                    return 0;
-                }
-                inputArguments[arguments[a].code] = argv[i+1];
+        if (arguments[a].code == HELP){
+            std::cout << helpMessage << std::endl;
+            return 0;
+        }
+        inputArguments[arguments[a].code] = arguments[a].takesValue ? argv[++i] : "";
+    }
+    //Server mode takes its matrices from requests, so none of the other arguments are required
+    if (argGiven(inputArguments, SERVE)){
+        if (argGiven(inputArguments, PRECISION) && !setPrec(std::cout, inputArguments[PRECISION])){
+            return 0;
+        }
+        int precision = argGiven(inputArguments, PRECISION) ? static_cast<int>(std::cout.precision()) : defaultPrecision;
+        int cacheEntries = defaultCacheEntries;
+        if (argGiven(inputArguments, CACHE)){
+            try {
+                cacheEntries = std::stoi(inputArguments[CACHE]);
+            } catch (const std::invalid_argument &e){
+                cacheEntries = -1;
+            }
+            if (cacheEntries < 0){
+                std::cout << inputArguments[CACHE] << " is not a valid cache size, it must be a non negative integer" << std::endl;
+                return 0;
             }
         }
+        return runServer(inputArguments[SERVE], precision, cacheEntries);
     }
+
+    //A benchmark makes up its own matrices, so it only needs the dimension
+    bool benchmark = argGiven(inputArguments, BENCHMARK);
+    //A pseudo-inverse can take a separate width and height in place of the dimension
+    bool rectangular = argGiven(inputArguments, PINV) && argGiven(inputArguments, WIDTH) && argGiven(inputArguments, HEIGHT);
     //The mandadtory arguments are Dimension and Input, if they are not present, then warn the user to user and exit.
     for (int i = 0; i < numArgs; i++){
-        if (arguments[i].mandatory && !argGiven(inputArguments, arguments[i].code)){
+        if (arguments[i].mandatory && !argGiven(inputArguments, arguments[i].code) && !(benchmark && arguments[i].code == INPUT)
+            && !(rectangular && arguments[i].code == DIMENSION)){
             std::cout << "Must have at least:";
             for (int a = 0; a < numArgs; a++){
                 if (arguments[a].mandatory){
@@ -88,18 +171,33 @@ int main(int argc, char *argv[])
     }
 
     //Hold the dimension of the matrix in question
-    int dim;
-    //casting command line argument to integer requires much checking
-    try{
-        dim = std::stoi(inputArguments[DIMENSION]);
-        if (dim <= 1){
-            std::cout << "The dimension must be greater than 1" << std::endl;
+    int dim = 0;
+    if (!rectangular && !parseSize(inputArguments[DIMENSION], "dimension", 2, dim)){
+        return 0;
+    }
+    int width = dim, height = dim;
+    if (rectangular && (!parseSize(inputArguments[WIDTH], "width", 1, width) || !parseSize(inputArguments[HEIGHT], "height", 1, height))){
+        return 0;
+    }
+
+    if (benchmark){
+        return runBenchmark(dim);
+    }
+
+#ifdef MATRIX_USE_MPI
+    //Under mpirun with more than one rank, the matrix is spread across all of them
+    int ranks;
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    if (ranks > 1 && !argGiven(inputArguments, PINV)){
+        std::ostringstream probe;
+        probe.precision(defaultPrecision);
+        if (argGiven(inputArguments, PRECISION) && !setPrec(probe, inputArguments[PRECISION])){
             return 0;
         }
-    } catch (std::invalid_argument e){
-        std::cout << inputArguments[DIMENSION] << " is not a valid dimension, dimension must be an integer" << std::endl;
-        return 0;
+        std::string outputName = argGiven(inputArguments, OUTPUT) ? inputArguments[OUTPUT] : "";
+        return invertDistributed(inputArguments[INPUT], outputName, static_cast<int>(probe.precision()), dim);
     }
+#endif
 
     //Open input file
     std::ifstream matrix_file(inputArguments[INPUT]);
@@ -108,49 +206,58 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    //Read file contents into data vector
-    std::vector<double> data;
-    std::copy(
-        std::istream_iterator<double>(matrix_file),
-        std::istream_iterator<double>(),
-        std::back_inserter(data)
-    );
-    matrix_file.close();
+    //Number of matrices to read from the input file
+    int count = 1;
+    if (argGiven(inputArguments, COUNT)){
+        try {
+            count = std::stoi(inputArguments[COUNT]);
+        } catch (const std::invalid_argument &e){
+            count = -1;
+        }
+        if (count < 0){
+            std::cout << inputArguments[COUNT] << " is not a valid count, count must be a non negative integer" << std::endl;
+            return 0;
+        }
+    }
 
-    try {
-        Matrix::matrix<double> A(dim, dim, &data);
-        //If the output is to go to an output file
-        if (!argGiven(inputArguments, OUTPUT)){
-            //Set precision
-            if (!argGiven(inputArguments, PRECISION)){
-                std::cout.precision(defaultPrecision);
-            } else if (!setPrec(std::cout, inputArguments[PRECISION])){
-                return 0;
-            }
-            //INVERT!
-            std::cout << Matrix::invert(A);
-        } else {
-            //Open/Create output file
-            std::ofstream outputFile (inputArguments[OUTPUT]);
-            if (!outputFile.is_open()){
-                std::cout << "Could not open file: " << inputArguments[OUTPUT] << std::endl;
-                return 0;
-            }
-            //Set precision
-            if (!argGiven(inputArguments, PRECISION)){
-                outputFile.precision(defaultPrecision);
-            } else if (!setPrec(outputFile, inputArguments[PRECISION])){
-                return 0;
-            }
-            //INVERT!
-            outputFile << Matrix::invert(A);
-            outputFile.close();
+    //If the output is to go to an output file, open/create it, otherwise use the terminal
+    std::ofstream outputFile;
+    std::ostream* output = &std::cout;
+    if (argGiven(inputArguments, OUTPUT)){
+        outputFile.open(inputArguments[OUTPUT]);
+        if (!outputFile.is_open()){
+            std::cout << "Could not open file: " << inputArguments[OUTPUT] << std::endl;
+            return 0;
         }
-    } catch (Matrix::matrixException e){
-        std::cout << e.getErrorMessage() << std::endl;
+        output = &outputFile;
+    }
+    //Set precision
+    if (!argGiven(inputArguments, PRECISION)){
+        output->precision(defaultPrecision);
+    } else if (!setPrec(*output, inputArguments[PRECISION])){
         return 0;
     }
-    return 0;
+
+    //Rectangular (or singular looking) matrices get a least squares pseudo-inverse
+    if (argGiven(inputArguments, PINV)){
+        pseudoInvert(matrix_file, *output, width, height);
+        return 0;
+    }
+
+    //Integer matrices can be inverted without rounding, by modular arithmetic
+    if (argGiven(inputArguments, EXACT)){
+        invertExactly(matrix_file, *output, dim);
+        return 0;
+    }
+
+    //Matrices too big for memory are inverted a tile at a time through a scratch file
+    if (argGiven(inputArguments, SCRATCH)){
+        invertOutOfCore(matrix_file, *output, dim, inputArguments[SCRATCH]);
+        return 0;
+    }
+
+    //Read, INVERT! and write, with each stage running concurrently
+    return runPipeline(matrix_file, *output, dim, count, argGiven(inputArguments, STATS));
 }
 
 inline bool argGiven(const argMap &m, ArgCode a){
@@ -170,12 +277,156 @@ bool setPrec(std::ostream &out, const std::string &str){
             return false;
         }
         out.precision(p);
-    } catch (std::invalid_argument e) {
+    } catch (const std::invalid_argument &e) {
         std::cout << str << " is not a valid precision, precision must be an integer" << std::endl;
         return false;
     }
     return true;
 }
+/*
+Parse a matrix size from the command line, which must be an integer of at least minimum
+return true if all is successful, otherwise warn the user and return false
+*/
+bool parseSize(const std::string &str, const char* name, int minimum, int &size){
+    //casting command line argument to integer requires much checking
+    try{
+        size = std::stoi(str);
+        if (size < minimum){
+            std::cout << "The " << name << " must be greater than " << minimum - 1 << std::endl;
+            return false;
+        }
+    } catch (const std::invalid_argument &e){
+        std::cout << str << " is not a valid " << name << ", " << name << " must be an integer" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+Read one width*height matrix and write its height*width pseudo-inverse.
+Missing input elements are left as 0, matching the other paths.
+*/
+void pseudoInvert(std::istream &input, std::ostream &output, int width, int height){
+    std::vector<double> values{std::istream_iterator<double>(input), std::istream_iterator<double>()};
+    try {
+        Matrix::matrix<double> A(width, height, &values);
+        output << Matrix::pseudoInverse(A);
+        output.flush();
+    } catch (Matrix::matrixException e){
+        std::cout << e.getErrorMessage() << std::endl;
+    }
+}
+
+/*
+Read one dim*dim integer matrix and write its exact inverse. Anything in the input that is not
+an integer stops the read with a message, rather than being silently truncated.
+Missing input elements are left as 0, matching the other paths.
+*/
+void invertExactly(std::istream &input, std::ostream &output, int dim){
+    std::vector<long long> values;
+    std::string token;
+    while (input >> token){
+        size_t used = 0;
+        try {
+            values.push_back(std::stoll(token, &used));
+        } catch (const std::exception &e){
+            used = 0;
+        }
+        if (used != token.size()){
+            std::cout << token << " is not an integer, exact inversion needs an integer matrix" << std::endl;
+            return;
+        }
+    }
+    try {
+        Matrix::matrix<long long> A(dim, dim, &values);
+        output << Matrix::invertExact(A);
+        output.flush();
+    } catch (Matrix::matrixException e){
+        std::cout << e.getErrorMessage() << std::endl;
+    }
+}
+
+/*
+Invert a single matrix out of core. The input is streamed straight into a tiled matrix and the
+inverse streamed back out a row at a time, so neither is ever held in memory as a whole.
+Missing input elements are left as 0, matching the in memory path.
+*/
+void invertOutOfCore(std::istream &input, std::ostream &output, int dim, const std::string &scratch){
+    try {
+        Matrix::tiledMatrix<double> A(dim, dim, scratch);
+        Matrix::tiledMatrix<double> inverse(dim, dim, scratch);
+        const long long total = static_cast<long long>(dim) * dim;
+        double value;
+        for (long long i = 0; i < total && input >> value; i++){
+            A.set(static_cast<int>(i / dim), static_cast<int>(i % dim), value);
+        }
+        Matrix::invert(A, inverse);
+        //Same layout as writing a matrix with operator<<
+        const char* space = (output.precision() <= 4) ? "\t" : "    ";
+        for (int y = 0; y < dim; y++){
+            for (int x = 0; x < dim; x++){
+                output << inverse.get(y, x) << space;
+            }
+            output << '\n';
+        }
+        output.flush();
+    } catch (Matrix::matrixException e){
+        std::cout << e.getErrorMessage() << std::endl;
+    }
+}
+
+#ifdef MATRIX_USE_MPI
+/*
+Invert a single matrix across all MPI ranks. The root reads the input and writes the inverse,
+in between the matrix lives in a block cyclic layout over every rank.
+An empty output name writes to the terminal.
+*/
+int invertDistributed(const std::string &input, const std::string &output, int precision, int dim){
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    Matrix::matrix<double> A;
+    int opened = 1;
+    if (rank == 0){
+        std::ifstream matrix_file(input);
+        if (!matrix_file.is_open()){
+            std::cout << "could not open file: " << input << std::endl;
+            opened = 0;
+        } else {
+            std::vector<double> values{std::istream_iterator<double>(matrix_file), std::istream_iterator<double>()};
+            A = Matrix::matrix<double>(dim, dim, &values);
+        }
+    }
+    MPI_Bcast(&opened, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!opened){
+        return 0;
+    }
+    try {
+        Matrix::distributedMatrix distributed(dim, dim);
+        distributed.scatter(A);
+        Matrix::invert(distributed);
+        Matrix::matrix<double> inverse = distributed.gather();
+        if (rank == 0){
+            std::ofstream outputFile;
+            std::ostream* out = &std::cout;
+            if (!output.empty()){
+                outputFile.open(output);
+                if (!outputFile.is_open()){
+                    std::cout << "Could not open file: " << output << std::endl;
+                    return 0;
+                }
+                out = &outputFile;
+            }
+            out->precision(precision);
+            *out << inverse;
+            out->flush();
+        }
+    } catch (Matrix::matrixException e){
+        std::cout << e.getErrorMessage() << std::endl;
+    }
+    return 0;
+}
+#endif
+
 /*
 Create dynamic help message based on possible arguments
 This is better than a static message, because it makes the help message much easier to keep  up to date
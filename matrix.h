@@ -8,7 +8,26 @@ Written by Andrew M. Hall
 #include <string>
 #include <vector>
 #include <iostream>
+#include <type_traits>
+#include <utility>
+#include <cmath>
 #include "matrixError.h"
+#include "matrixThreads.h"
+#include "matrixMemory.h"
+#include "matrixBlas.h"
+#include "matrixSimd.h"
+#include "matrixHalf.h"
+#include "matrixStructure.h"
+
+/*
+Bounds checking policy. operator[] always range checks, it is the access path for callers.
+operator() and the raw row pointers used by the algorithms in this file are only checked when
+MATRIX_BOUNDS_CHECK is non zero (see "make debug"), so release builds carry no branches in
+their inner loops.
+*/
+#ifndef MATRIX_BOUNDS_CHECK
+#define MATRIX_BOUNDS_CHECK 0
+#endif
 
 namespace Matrix
 {
@@ -22,17 +41,22 @@ class vector;
 //Generic Matrix Friend functions
 template <class Type> Type determinant(const matrix<Type> &a, int row);
 template <class Type> Type determinant2x2(const matrix<Type> &a);
+template <class Type> double factoredDeterminant(const matrix<Type> &a);
 template <class Type> matrix<Type> adjoint(const matrix<Type> &a);
 template <class Type> matrix<Type> cofactor(const matrix<Type> &a);
 template <class Type> matrix<Type> transpose(const matrix<Type> &a);
 template <class Type> matrix<double> invert2x2(const matrix<Type> &a);
 template <class Type> matrix<double> invert(const matrix<Type> &a);
+template <class Type> matrix<double> invertBlocked(const matrix<Type> &a, int base = 0);
 template <class Type> matrix<Type> operator+(const matrix<Type> &a, const matrix<Type> &b);
 template <class Type> matrix<Type> operator-(const matrix<Type> &a);
 template <class Type> matrix<Type> operator-(const matrix<Type> &a, const matrix<Type> &b);
 template <class Type> vector<Type> operator*(const matrix<Type> &a, const vector<Type> &b);
+template <class Type> void multiplyBatch(const matrix<Type> &a, const Type* in, int count, Type* out);
 template <class Type> matrix<Type> operator*(const matrix<Type> &a, Type b);
 template <class Type> matrix<Type> operator*(const matrix<Type> &a, const matrix<Type> &b);
+template <class Type> void multiplyInto(const matrix<Type> &a, const matrix<Type> &b, matrix<Type> &output);
+template <class Type> void multiplyWidened(const matrix<Type> &a, const matrix<Type> &b, matrix<Type> &output);
 template <class Type> bool operator==(const matrix<Type> &a, const matrix<Type> &b);
 template <class Type> bool operator!=(const matrix<Type> &a, const matrix<Type> &b);
 template <class Type> std::ostream& operator<<(std::ostream &out, const matrix<Type> &a);
@@ -44,18 +68,19 @@ template <class Type>
 class matrix
 {
 protected:
+    template <class Other> friend class matrix;
     int size;
     int width;
     int height;
     Type* data;
 public:
     matrix(int in_width, int in_height);
-    matrix() : data(nullptr), width(1), height(0), size(0) {};
+    matrix() : size(0), width(1), height(0), data(nullptr) {};
     matrix(const matrix<Type> &in_matrix);
     matrix(int in_width, int in_height, std::vector<Type>* input);
     ~matrix()
     {
-        delete[] data;
+        release(data);
         data = nullptr;
     };
     int getWidth()const
@@ -66,16 +91,52 @@ public:
     {
         return height;
     };
+    //Raw storage, row y starts at getData() + y*getStride()
+    Type* getData()const
+    {
+        return data;
+    };
+    int getStride()const
+    {
+        return size;
+    };
+    Type& operator()(int row, int col)
+    {
+#if MATRIX_BOUNDS_CHECK
+        if (row < 0 || row >= height || col < 0 || col >= width)
+            throw matrixException(BOUNDS_ERROR);
+#endif
+        return data[row*size + col];
+    };
+    const Type& operator()(int row, int col)const
+    {
+#if MATRIX_BOUNDS_CHECK
+        if (row < 0 || row >= height || col < 0 || col >= width)
+            throw matrixException(BOUNDS_ERROR);
+#endif
+        return data[row*size + col];
+    };
     Type* getRow(int y)const;
     Type* getColum(int x)const;
     void map(Type(*function)(Type));
+    //Exchange contents with another matrix without copying any elements
+    void swap(matrix<Type> &other)
+    {
+        std::swap(size, other.size);
+        std::swap(width, other.width);
+        std::swap(height, other.height);
+        std::swap(data, other.data);
+    };
     //Type conversion
-    operator matrix<bool>();
-    operator matrix<unsigned char>();
-    operator matrix<short>();
-    operator matrix<int>();
-    operator matrix<float>();
-    operator matrix<double>();
+    template <class Out> void convertInto(matrix<Out> &output)const;
+    operator matrix<bool>()const;
+    operator matrix<unsigned char>()const;
+    operator matrix<short>()const;
+    operator matrix<int>()const;
+    operator matrix<float>()const;
+    operator matrix<double>()const;
+    operator matrix<half>()const;
+    operator matrix<bfloat16>()const;
     //Matrix manipulation
     friend Type determinant <>(const matrix<Type> &a, int col);
     friend Type determinant2x2 <>(const matrix<Type> &a);
@@ -90,8 +151,10 @@ public:
     friend matrix<Type> operator- <>(const matrix<Type> &a);
     friend matrix<Type> operator- <>(const matrix<Type> &a, const matrix<Type> &b);
     friend vector<Type> operator* <>(const matrix<Type> &a, const vector<Type> &b);
+    friend void multiplyBatch <>(const matrix<Type> &a, const Type* in, int count, Type* out);
     friend matrix<Type> operator* <>(const matrix<Type> &a, Type b);
     friend matrix<Type> operator* <>(const matrix<Type> &a, const matrix<Type> &b);
+    friend void multiplyInto <>(const matrix<Type> &a, const matrix<Type> &b, matrix<Type> &output);
     friend bool operator==<>(const matrix<Type> &a, const matrix<Type> &b);
     friend bool operator!=<>(const matrix<Type> &a, const matrix<Type> &b);
     friend std::ostream& operator<< <>(std::ostream &out, const matrix<Type> &a);
@@ -126,14 +189,7 @@ matrix<Type>::matrix(int in_width, int in_height, std::vector<Type>* input)
     width = in_width;
     height = in_height;
     size = (width > height) ? width : height;
-    try
-    {
-        data = new Type[size*size];
-    }
-    catch (std::bad_alloc)
-    {
-        throw(matrixException(MEMORY_ERROR));
-    }
+    data = allocate<Type>(static_cast<size_t>(size)*size);
     int i = 0;
     for (int y = 0; y < height; y++)
     {
@@ -159,14 +215,7 @@ matrix<Type>::matrix(int in_width, int in_height)
     width = in_width;
     height = in_height;
     size = (width > height) ? width : height;
-    try
-    {
-        data = new Type[size*size];
-    }
-    catch (std::bad_alloc)
-    {
-        throw(matrixException(MEMORY_ERROR));
-    }
+    data = allocate<Type>(static_cast<size_t>(size)*size);
 }
 
 /*
@@ -181,19 +230,12 @@ matrix<Type>::matrix(const matrix<Type> &in_matrix)
         width = in_matrix.width;
         height = in_matrix.height;
         size = in_matrix.size;
-        try
-        {
-            data = new Type[size*size];
-        }
-        catch (std::bad_alloc)
-        {
-            throw(matrixException(MEMORY_ERROR));
-        }
+        data = allocate<Type>(static_cast<size_t>(size)*size);
         for (int y = 0; y < height; y++)
         {
             for (int x = 0; x < width; x++)
             {
-                data[y*size + x] = in_matrix[y][x];
+                data[y*size + x] = in_matrix(y, x);
             }
         }
     }
@@ -286,15 +328,19 @@ matrix<double> invert2x2(const matrix<Type> &a)
     if (!det)
         throw matrixException(MATH_ERROR);
     double d = 1.0 / det;
-    output[0][0] = (a[1][1] * d);
-    output[0][1] = (-a[0][1] * d);
-    output[1][0] = (-a[1][0] * d);
-    output[1][1] = (a[0][0] * d);
+    output(0, 0) = (a(1, 1) * d);
+    output(0, 1) = (-a(0, 1) * d);
+    output(1, 0) = (-a(1, 0) * d);
+    output(1, 1) = (a(0, 0) * d);
     return output;
 }
 
 /*
-Invert a matrix using recursive method. This is find for up to 10*10.
+Invert a matrix using recursive method. This is find for up to 10*10, and is kept for the
+smallest matrices; anything bigger than cofactorLimit goes to the block inversion in matrixSchur.h.
+Diagonal, permutation, triangular and narrow banded matrices are found first and go to the
+kernels in matrixStructure.h instead, as do symmetric positive definite ones when Cholesky beats
+the parallel dense path.
 If the matrix is not square, dimension error is thrown.
 If the matrix has a determinant of 0, math error is thrown.
 */
@@ -305,11 +351,24 @@ matrix<double> invert(const matrix<Type> &a)
     int h = a.height;
     if (w != h)
         throw matrixException(DIMENSION_ERROR);
+    matrix<double> output(w, h);
+    if (structure::invert(a.data, a.size, w, output.getData(), output.getStride()))
+    {
+        return output;
+    }
+    if (blas::routines<Type>::invert(a.data, a.size, output.getData(), output.getStride(), w))
+    {
+        return output;
+    }
     if (h == 2)
     {
         return invert2x2(a);
     }
-    matrix<double> output(w, h);
+    const int cofactorLimit = 4;
+    if (h > cofactorLimit)
+    {
+        return invertBlocked(a);
+    }
     double det = static_cast<double>(determinant(a,0));
     if (!det)
         throw matrixException(MATH_ERROR);
@@ -327,6 +386,10 @@ matrix<Type> adjoint(const matrix<Type> &a)
 
 /*
 calculate the determinant of a square, n*n matrix
+triangular and permutation matrices are read off directly
+Up to cofactorLimit it is the cofactor expansion, whose cost grows with n factorial, so
+larger matrices use the pivots of an LU decomposition (matrixLU.h), giving 0 if it finds the
+matrix singular. An integer determinant found that way is rounded to the nearest integer.
 */
 template <class Type>
 Type determinant(const matrix<Type> &a, int row)
@@ -336,6 +399,20 @@ Type determinant(const matrix<Type> &a, int row)
     if (h != w)
         throw matrixException(DIMENSION_ERROR);
     Type output = 0;
+    if (structure::determinant(a.data, a.size, w, output))
+    {
+        return output;
+    }
+    if (blas::routines<Type>::determinant(a.data, a.size, w, output))
+    {
+        return output;
+    }
+    const int cofactorLimit = 4;
+    if (h > cofactorLimit)
+    {
+        const double det = factoredDeterminant(a);
+        return static_cast<Type>(std::is_integral<Type>::value ? std::round(det) : det);
+    }
     bool s = (row == 0) || (row % 2 == 0);
     if (h == 2)
     {
@@ -356,13 +433,13 @@ Type determinant(const matrix<Type> &a, int row)
                     {
                         if (x != tmpX)
                         {
-                            tmp[ycount][xcount++] = a[y][x];
+                            tmp(ycount, xcount++) = a(y, x);
                         }
                     }
                     ycount++;
                 }
             }
-            output += s ? ((determinant(tmp,0) * (a[row][tmpX]))) : -((determinant(tmp,0) * (a[row][tmpX])));
+            output += s ? ((determinant(tmp,0) * (a(row, tmpX)))) : -((determinant(tmp,0) * (a(row, tmpX))));
             s = !s;
         }
     }
@@ -375,7 +452,7 @@ basic case for the determinant, the determinant of a 2*2 matrix has a simple for
 template <class Type>
 Type determinant2x2(const matrix<Type> &a)
 {
-    return a[0][0] * a[1][1] - a[0][1] * a[1][0];
+    return a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
 }
 
 /*
@@ -404,7 +481,7 @@ matrix<Type> cofactor(const matrix<Type> &a)
                     {
                         if (xdet != x)
                         {
-                            det[ycount][xcount++] = a[ydet][xdet];
+                            det(ycount, xcount++) = a(ydet, xdet);
                         }
                     }
                     ycount++;
@@ -412,11 +489,11 @@ matrix<Type> cofactor(const matrix<Type> &a)
             }
             if ((y + x) % 2 == 0)
             {
-                output[y][x] = determinant(det,0);
+                output(y, x) = determinant(det,0);
             }
             else
             {
-                output[y][x] = -determinant(det,0);
+                output(y, x) = -determinant(det,0);
             }
         }
     }
@@ -428,6 +505,14 @@ simple transpose of a matrix
 template <class Type>
 matrix<Type> transpose(const matrix<Type> &a)
 {
+    if (a.data && blas::enabled())
+    {
+        matrix<Type> output(a.height, a.width);
+        if (blas::routines<Type>::transpose(a.data, a.size, output.data, output.size, a.height, a.width))
+        {
+            return output;
+        }
+    }
     matrix<Type> output(a);
     for (int y = 0; y < a.size; y++)
     {
@@ -491,9 +576,12 @@ matrix<Type> operator+(const matrix<Type> &a, const matrix<Type> &b)
     matrix<Type> output(myWidth, myHeight);
     for (int y = 0; y < myHeight; y++)
     {
+        const Type* aRow = a.data + y*a.size;
+        const Type* bRow = b.data + y*b.size;
+        Type* outRow = output.data + y*output.size;
         for (int x = 0; x < myWidth; x++)
         {
-            output[y][x] = a[y][x] + b[y][x];
+            outRow[x] = aRow[x] + bRow[x];
         }
     }
     return output;
@@ -509,7 +597,7 @@ matrix<Type>& matrix<Type>::operator=(const matrix<Type> &a)
     {
         return *this;
     }
-    delete[] data;
+    release(data);
 
     width = a.width;
     height = a.height;
@@ -517,19 +605,12 @@ matrix<Type>& matrix<Type>::operator=(const matrix<Type> &a)
 
     if (a.data)
     {
-        try
-        {
-            data = new Type[size*size];
-        }
-        catch (std::bad_alloc)
-        {
-            throw(matrixException(MEMORY_ERROR));
-        }
+        data = allocate<Type>(static_cast<size_t>(size)*size);
         for (int y = 0; y < height; y++)
         {
             for (int x = 0; x < width; x++)
             {
-                data[y*size + x] = a[y][x];
+                data[y*size + x] = a(y, x);
             }
         }
     }
@@ -552,28 +633,150 @@ Type* matrix<Type>::operator[](int a)const
     return data + size * a;
 }
 
+/*
+Product for storage types that are narrower than their arithmetic, such as half. Each block of B
+is widened once per chunk of rows into a panel that stays in cache, and the chunk's output rows
+are summed in a wide buffer and only narrowed at the end, so the 16 bit matrices are streamed
+at half the bandwidth without rounding the partial sums.
+*/
+template <class Type>
+void multiplyWidened(const matrix<Type> &a, const matrix<Type> &b, matrix<Type> &output)
+{
+    typedef typename simd::accumulator<Type>::type Wide;
+    const int kBlock = 128;
+    const int xBlock = 256;
+    const int rowBlock = 32;
+    const int n = a.getWidth();
+    const int p = b.getWidth();
+    const Type* aData = a.getData();
+    const Type* bData = b.getData();
+    Type* outData = output.getData();
+    const int aStride = a.getStride();
+    const int bStride = b.getStride();
+    const int outStride = output.getStride();
+    threadPool::instance().parallelFor(0, a.getHeight(), rowBlock, [=](int first, int last)
+    {
+        std::vector<Wide> sums(static_cast<size_t>(last - first) * p, Wide(0));
+        std::vector<Wide> panel(static_cast<size_t>(kBlock) * xBlock);
+        for (int k0 = 0; k0 < n; k0 += kBlock)
+        {
+            int k1 = (k0 + kBlock < n) ? k0 + kBlock : n;
+            checkpoint();
+            for (int x0 = 0; x0 < p; x0 += xBlock)
+            {
+                int x1 = (x0 + xBlock < p) ? x0 + xBlock : p;
+                const int columns = x1 - x0;
+                for (int k = k0; k < k1; k++)
+                {
+                    simd::convert(bData + static_cast<size_t>(k)*bStride + x0, panel.data() + (k - k0)*columns, columns);
+                }
+                for (int y = first; y < last; y++)
+                {
+                    const Type* aRow = aData + static_cast<size_t>(y)*aStride;
+                    Wide* sumRow = sums.data() + static_cast<size_t>(y - first)*p + x0;
+                    for (int k = k0; k < k1; k++)
+                    {
+                        const Wide scale = static_cast<Wide>(aRow[k]);
+                        const Wide* panelRow = panel.data() + (k - k0)*columns;
+                        for (int x = 0; x < columns; x++)
+                        {
+                            sumRow[x] += scale * panelRow[x];
+                        }
+                    }
+                }
+            }
+            reportProgress(static_cast<long long>(last - first) * (k1 - k0) * p);
+        }
+        for (int y = first; y < last; y++)
+        {
+            simd::convert(sums.data() + static_cast<size_t>(y - first)*p, outData + static_cast<size_t>(y)*outStride, p);
+        }
+    });
+}
+
+/*
+matrix product, an m*n matrix times an n*p matrix gives an m*p matrix.
+Each output row is accumulated as a sum of rows of B scaled by elements of A, so the inner loop
+runs along contiguous memory. B is walked in blocks that stay in cache while a chunk of output
+rows is built, and chunks of rows are shared out over the thread pool.
+*/
 template <class Type>
 matrix<Type> operator*(const matrix<Type> &a, const matrix<Type> &b)
 {
-    if (a.width != b.height || a.height != b.width)
+    if (a.width != b.height)
         throw matrixException(DIMENSION_ERROR);
+    matrix<Type> output(b.width, a.height);
+    multiplyInto(a, b, output);
+    return output;
+}
 
-    matrix<Type> output(a.height, b.width);
-    for (int y = 0; y < a.height; y++)
+/*
+output = A*B, reusing output's storage when it already has the right shape, so a loop of
+products can alternate between a fixed set of buffers instead of allocating every time.
+output may not be A or B.
+*/
+template <class Type>
+void multiplyInto(const matrix<Type> &a, const matrix<Type> &b, matrix<Type> &output)
+{
+    if (a.width != b.height)
+        throw matrixException(DIMENSION_ERROR);
+    if (&output == &a || &output == &b)
+        throw matrixException(OTHER);
+
+    const int kBlock = 128;
+    const int xBlock = 256;
+    const int n = a.width;
+    const int p = b.width;
+    if (!output.data || output.width != p || output.height != a.height)
+    {
+        matrix<Type> fresh(p, a.height);
+        output.swap(fresh);
+    }
+    if (blas::routines<Type>::multiply(a.data, a.size, b.data, b.size, output.data, output.size, a.height, p, n))
+    {
+        return;
+    }
+    if (!std::is_same<typename simd::accumulator<Type>::type, Type>::value)
     {
-        Type * tmpRow = a.getRow(y);
-        for (int x = 0; x < b.width; x++)
+        multiplyWidened(a, b, output);
+        return;
+    }
+    const int grain = 1 + 65536 / (1 + n * (p > 1 ? p : 1));
+    threadPool::instance().parallelFor(0, a.height, grain, [&](int first, int last)
+    {
+        for (int y = first; y < last; y++)
         {
-            Type * tmpCol = b.getColum(x);
-            Type total = 0;
-            for (int i = 0; i < a.width; i++)
+            Type* outRow = output.data + y*output.size;
+            for (int x = 0; x < p; x++)
             {
-                total += tmpRow[i] * tmpCol[i];
+                outRow[x] = 0;
             }
-            output[y][x] = total;
         }
-    }
-    return output;
+        for (int k0 = 0; k0 < n; k0 += kBlock)
+        {
+            int k1 = (k0 + kBlock < n) ? k0 + kBlock : n;
+            checkpoint();
+            for (int x0 = 0; x0 < p; x0 += xBlock)
+            {
+                int x1 = (x0 + xBlock < p) ? x0 + xBlock : p;
+                for (int y = first; y < last; y++)
+                {
+                    const Type* aRow = a.data + y*a.size;
+                    Type* outRow = output.data + y*output.size;
+                    for (int k = k0; k < k1; k++)
+                    {
+                        const Type scale = aRow[k];
+                        const Type* bRow = b.data + k*b.size;
+                        for (int x = x0; x < x1; x++)
+                        {
+                            outRow[x] += scale * bRow[x];
+                        }
+                    }
+                }
+            }
+            reportProgress(static_cast<long long>(last - first) * (k1 - k0) * p);
+        }
+    });
 }
 
 //Matrix multiplication
@@ -588,16 +791,78 @@ vector<Type> operator*(const matrix<Type> &a, const vector<Type> &b)
     vector<Type> output(m_height);
     for (int y = 0; y < m_height; y++)
     {
+        const Type* row = a.data + y*a.size;
         Type total = 0;
         for (int x = 0; x < m_width; x++)
         {
-            total += a[y][x] * b[x][0];
+            total += row[x] * b.data[x*b.size];
         }
-        *output[y] = total;
+        output.data[y*output.size] = total;
     }
     return output;
 }
 
+/*
+Batched matrix vector product, out_j = A * in_j for each of count vectors.
+in holds the vectors back to back, each getWidth() long, out receives count results each
+getHeight() long. Rows of A are taken a cache sized tile at a time while a block of vectors
+streams past, and the (tile, block) pairs are shared out over the thread pool.
+Nothing is allocated, so this is safe to call at a high rate against the same matrix.
+*/
+template <class Type>
+void multiplyBatch(const matrix<Type> &a, const Type* in, int count, Type* out)
+{
+    const int vectorBlock = 16;
+    const size_t tileBytes = 128 * 1024;
+    const int w = a.width;
+    const int h = a.height;
+    if (count <= 0 || h <= 0)
+        return;
+    int rowTile = static_cast<int>(tileBytes / (sizeof(Type) * (w > 0 ? w : 1)));
+    if (rowTile < 4)
+        rowTile = 4;
+    if (rowTile > h)
+        rowTile = h;
+    const int rowTiles = (h + rowTile - 1) / rowTile;
+    const int vectorBlocks = (count + vectorBlock - 1) / vectorBlock;
+    const int jobs = rowTiles * vectorBlocks;
+    //Not worth waking the pool for less than a few hundred thousand multiply-adds
+    const double work = static_cast<double>(w) * h * count;
+    const int grain = (work < 262144.0) ? jobs : 1;
+    const Type* A = a.data;
+    const int stride = a.size;
+    threadPool::instance().parallelFor(0, jobs, grain, [=](int first, int last)
+    {
+        for (int job = first; job < last; job++)
+        {
+            int y0 = (job / vectorBlocks) * rowTile;
+            int y1 = (y0 + rowTile < h) ? y0 + rowTile : h;
+            int v0 = (job % vectorBlocks) * vectorBlock;
+            int v1 = (v0 + vectorBlock < count) ? v0 + vectorBlock : count;
+            for (int y = y0; y < y1; y++)
+            {
+                const Type* row = A + static_cast<size_t>(y) * stride;
+                int v = v0;
+                for (; v + 4 <= v1; v += 4)
+                {
+                    Type r[4];
+                    const Type* x = in + static_cast<size_t>(v) * w;
+                    simd::dot4(row, x, x + w, x + 2 * w, x + 3 * w, w, r);
+                    Type* y_out = out + static_cast<size_t>(v) * h + y;
+                    y_out[0] = r[0];
+                    y_out[h] = r[1];
+                    y_out[2 * h] = r[2];
+                    y_out[3 * h] = r[3];
+                }
+                for (; v < v1; v++)
+                {
+                    out[static_cast<size_t>(v) * h + y] = simd::dot(row, in + static_cast<size_t>(v) * w, w);
+                }
+            }
+        }
+    });
+}
+
 //Scalar multiplication
 template <class Type>
 matrix<Type> operator*(const matrix<Type> &a, Type b)
@@ -607,9 +872,11 @@ matrix<Type> operator*(const matrix<Type> &a, Type b)
     matrix<Type> output(width, height);
     for (int y = 0; y < a.height; y++)
     {
+        const Type* aRow = a.data + y*a.size;
+        Type* outRow = output.data + y*output.size;
         for (int x = 0; x < a.width; x++)
         {
-            output[y][x] = a[y][x] * b;
+            outRow[x] = aRow[x] * b;
         }
     }
     return output;
@@ -628,7 +895,7 @@ bool operator==(const matrix<Type> &a, const matrix<Type> &b)
     {
         for (int x = 0; x < width; x++)
         {
-            if (a[y][x] != b[y][x])
+            if (a(y, x) != b(y, x))
             {
                 return false;
             }
@@ -652,7 +919,7 @@ std::ostream& operator<<(std::ostream &out, const matrix<Type> &a)
     {
         for (int x = 0; x < width; x++)
         {
-            out << a[y][x] << space;
+            out << a(y, x) << space;
         }
         out << std::endl;
     }
@@ -668,7 +935,7 @@ std::string toString(const matrix<Type> &m)
     {
         for (int x = 0; x < m.width; x++)
         {
-            output.append(to_string(m[y][x]));
+            output.append(std::to_string(m(y, x)));
             output.append(",\t");
         }
         output.append("\n");
@@ -678,87 +945,119 @@ std::string toString(const matrix<Type> &m)
 
 //static_cast section
 //Defined for all numeric types, and boolean and unsigned char
+
+/*
+Convert this matrix into output, reusing output's storage when it already has the same shape.
+The work is done a row (or the whole array when rows are contiguous) at a time by the bulk
+kernels in simd::convert, large matrices are split across the thread pool.
+Conversion to short and unsigned char saturates rather than wrapping.
+*/
 template <class Type>
-matrix<Type>::operator matrix<bool>()
+template <class Out>
+void matrix<Type>::convertInto(matrix<Out> &output)const
 {
-    matrix<bool> output(width, height);
-    for (int y = 0; y < height; y++)
+    if (!data)
     {
-        for (int x = 0; x < width; x++)
+        output = matrix<Out>();
+        return;
+    }
+    if (!output.data || output.width != width || output.height != height)
+    {
+        int outSize = (width > height) ? width : height;
+        Out* fresh = allocate<Out>(static_cast<size_t>(outSize)*outSize);
+        release(output.data);
+        output.data = fresh;
+        output.width = width;
+        output.height = height;
+        output.size = outSize;
+    }
+    const Type* in = data;
+    Out* out = output.data;
+    const int inStride = size;
+    const int outStride = output.size;
+    const int w = width;
+    if (w == inStride && w == outStride)
+    {
+        //Rows are back to back, convert as one flat array in page sized pieces
+        const int n = w * height;
+        const int grain = 1 << 16;
+        threadPool::instance().parallelFor(0, n, grain, [=](int first, int last)
         {
-            output[y][x] = static_cast<bool>(data[y*width + x]);
-        }
+            simd::convert(in + first, out + first, last - first);
+        });
+        return;
     }
+    const int rowGrain = 1 + (1 << 16) / (w > 0 ? w : 1);
+    threadPool::instance().parallelFor(0, height, rowGrain, [=](int first, int last)
+    {
+        for (int y = first; y < last; y++)
+        {
+            simd::convert(in + static_cast<size_t>(y) * inStride, out + static_cast<size_t>(y) * outStride, w);
+        }
+    });
+}
+
+template <class Type>
+matrix<Type>::operator matrix<bool>()const
+{
+    matrix<bool> output(width, height);
+    convertInto(output);
     return output;
 }
 
 template <class Type>
-matrix<Type>::operator matrix<unsigned char>()
+matrix<Type>::operator matrix<unsigned char>()const
 {
     matrix<unsigned char> output(width, height);
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            output[y][x] = static_cast<unsigned char>(data[y*size + x]);
-        }
-    }
+    convertInto(output);
     return output;
 }
 
 template <class Type>
-matrix<Type>::operator matrix<short>()
+matrix<Type>::operator matrix<short>()const
 {
     matrix<short> output(width, height);
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            output[y][x] = static_cast<short>(data[y*size + x]);
-        }
-    }
+    convertInto(output);
     return output;
 }
 
 template <class Type>
-matrix<Type>::operator matrix<int>()
+matrix<Type>::operator matrix<int>()const
 {
     matrix<int> output(width, height);
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            output[y][x] = static_cast<int>(data[y*size + x]);
-        }
-    }
+    convertInto(output);
     return output;
 }
 
 template <class Type>
-matrix<Type>::operator matrix<float>()
+matrix<Type>::operator matrix<float>()const
 {
     matrix<float> output(width, height);
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            output[y][x] = static_cast<float>(data[y*size + x]);
-        }
-    }
+    convertInto(output);
     return output;
 }
 
 template <class Type>
-matrix<Type>::operator matrix<double>()
+matrix<Type>::operator matrix<double>()const
 {
     matrix<double> output(width, height);
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            output[y][x] = static_cast<double>(data[y*size + x]);
-        }
-    }
+    convertInto(output);
+    return output;
+}
+
+template <class Type>
+matrix<Type>::operator matrix<half>()const
+{
+    matrix<half> output(width, height);
+    convertInto(output);
+    return output;
+}
+
+template <class Type>
+matrix<Type>::operator matrix<bfloat16>()const
+{
+    matrix<bfloat16> output(width, height);
+    convertInto(output);
     return output;
 }
 
@@ -769,14 +1068,7 @@ vector<Type>::vector(int in_height)
     matrix<Type>::width = 1;
     matrix<Type>::height = in_height;
     matrix<Type>::size = matrix<Type>::height;
-    try
-    {
-        matrix<Type>::data = new Type[matrix<Type>::size*matrix<Type>::size];
-    }
-    catch (std::bad_alloc)
-    {
-        throw(matrixException(MEMORY_ERROR));
-    }
+    matrix<Type>::data = allocate<Type>(static_cast<size_t>(matrix<Type>::size)*matrix<Type>::size);
 }
 
 //Vector code
@@ -788,14 +1080,7 @@ vector<Type>::vector(int in_height, std::vector<Type>* in_data)
     matrix<Type>::width = 1;
     matrix<Type>::height = in_height;
     matrix<Type>::size = matrix<Type>::height;
-    try
-    {
-        matrix<Type>::data = new Type[matrix<Type>::size*matrix<Type>::size];
-    }
-    catch (std::bad_alloc)
-    {
-        throw(matrixException(MEMORY_ERROR));
-    }
+    matrix<Type>::data = allocate<Type>(static_cast<size_t>(matrix<Type>::size)*matrix<Type>::size);
     for (int i = 0; i < matrix<Type>::height; i++)
     {
         matrix<Type>::data[i*matrix<Type>::size] = in_data->at(i);
@@ -819,9 +1104,12 @@ Type vector<Type>::operator[](int a)const
 {
     if (a < 0 || a >= matrix<Type>::height)
         throw matrixException(BOUNDS_ERROR);
-    return matrix<Type>::data + a;
+    return matrix<Type>::data[a * matrix<Type>::size];
 }
 
 }
 
+#include "matrixSchur.h"
+#include "matrixLU.h"
+
 #endif
@@ -0,0 +1,149 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_ASYNC_H
+#define MATRIX_ASYNC_H
+
+#include <future>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include "matrix.h"
+#include "matrixLU.h"
+
+namespace Matrix
+{
+
+/*
+asyncControl is the caller's handle on an asynchronous operation. It is cheap to copy, and every
+copy refers to the same operation. Cancelling is cooperative: the operation stops at its next
+checkpoint, between elimination steps or blocks of a product, and its future then throws
+cancelled error. Work done inside a BLAS call cannot be interrupted, and is not counted
+towards progress until the call returns.
+*/
+class asyncControl
+{
+public:
+    asyncControl() : state(std::make_shared<asyncState>()) {};
+    void cancel()
+    {
+        state->cancelled.store(true);
+    };
+    bool cancelled()const
+    {
+        return state->cancelled.load();
+    };
+    //Fraction of the estimated work done, from 0 to 1
+    double progress()const
+    {
+        const long long total = state->total.load(std::memory_order_relaxed);
+        if (total <= 0)
+            return 0.0;
+        const double fraction = static_cast<double>(state->done.load(std::memory_order_relaxed)) / total;
+        return std::min(fraction, 1.0);
+    };
+private:
+    template <class Result, class Function>
+    friend std::future<Result> launchAsync(asyncControl control, long long work, Function function);
+    std::shared_ptr<asyncState> state;
+};
+
+/*
+One asynchronous operation on the pool. It owns itself: nothing waits on it, so it hands its
+result or exception to the promise and deletes itself.
+*/
+template <class Result, class Function>
+class asyncTask : public threadPool::task
+{
+public:
+    asyncTask(const std::shared_ptr<asyncState> &in_state, Function in_function)
+        : state(in_state), function(std::move(in_function)) {};
+    std::future<Result> getFuture()
+    {
+        return promise.get_future();
+    };
+    void run()
+    {
+        try
+        {
+            checkpoint();
+            Result result = function();
+            state->done.store(std::max(state->done.load(), state->total.load()));
+            promise.set_value(std::move(result));
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+        delete this;
+    };
+private:
+    std::shared_ptr<asyncState> state;
+    Function function;
+    std::promise<Result> promise;
+};
+
+/*
+Run function on the pool as part of the operation control refers to, expecting it to report
+about work multiply-adds of progress, and return the future of its result.
+*/
+template <class Result, class Function>
+std::future<Result> launchAsync(asyncControl control, long long work, Function function)
+{
+    control.state->done.store(0);
+    control.state->total.store(work);
+    asyncTask<Result, Function>* t = new asyncTask<Result, Function>(control.state, std::move(function));
+    std::future<Result> output = t->getFuture();
+    threadPool::instance().post(t, control.state.get());
+    return output;
+}
+
+/*
+The asynchronous versions below take a copy of their arguments, so the caller may change or
+destroy them straight away, and return as soon as the work is queued. Errors that the blocking
+versions throw, including cancelled error, are thrown from the future's get() instead.
+*/
+
+/*
+As invert, on the pool. The work expected is estimated from the shape of a, so a matrix that goes
+to one of the structured kernels still counts up to the whole of its progress.
+*/
+template <class Type>
+std::future<matrix<double> > invertAsync(const matrix<Type> &a, asyncControl control = asyncControl())
+{
+    const long long n = a.getWidth();
+    long long work = n*n*n;
+    if (a.getWidth() == a.getHeight())
+        work = structure::inverseWork(structure::detect(a.getData(), a.getStride(), a.getWidth()));
+    return launchAsync<matrix<double> >(control, work, [a]()
+    {
+        return invert(a);
+    });
+}
+
+//As determinant, on the pool
+template <class Type>
+std::future<double> determinantAsync(const matrix<Type> &a, asyncControl control = asyncControl())
+{
+    const long long n = a.getWidth();
+    return launchAsync<double>(control, n*n*n/3, [a]()
+    {
+        return static_cast<double>(determinant(a, 0));
+    });
+}
+
+//As operator*, on the pool
+template <class Type>
+std::future<matrix<Type> > multiplyAsync(const matrix<Type> &a, const matrix<Type> &b, asyncControl control = asyncControl())
+{
+    const long long work = static_cast<long long>(a.getHeight()) * a.getWidth() * b.getWidth();
+    return launchAsync<matrix<Type> >(control, work, [a, b]()
+    {
+        return a * b;
+    });
+}
+
+}
+
+#endif
@@ -0,0 +1,797 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_BATCH_H
+#define MATRIX_BATCH_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include "matrix.h"
+
+namespace Matrix
+{
+
+/*
+Kernels over many small matrices at once. A batch stores element (row, col) of every matrix side
+by side, so one SIMD register holds the same element of several matrices, and each step of an
+algorithm is carried out on all of them together. This replaces the branches and short loops of
+a small matrix, which leave the vector units idle, with straight line code that keeps them full.
+*/
+namespace batch
+{
+
+/*
+pack is a register's worth of lanes, one matrix per lane. The generic version is a plain array
+the compiler may vectorise, float and double use AVX when it is available. A mask is a pack
+whose lanes are non zero where a comparison held.
+*/
+template <class Type>
+struct pack
+{
+    static const int width = 4;
+    Type v[width];
+    static pack load(const Type* p)
+    {
+        pack output;
+        for (int i = 0; i < width; i++)
+            output.v[i] = p[i];
+        return output;
+    };
+    void store(Type* p)const
+    {
+        for (int i = 0; i < width; i++)
+            p[i] = v[i];
+    };
+    static pack broadcast(Type x)
+    {
+        pack output;
+        for (int i = 0; i < width; i++)
+            output.v[i] = x;
+        return output;
+    };
+};
+
+#define MATRIX_PACK_OPERATOR(op) \
+template <class Type> \
+inline pack<Type> operator op(const pack<Type> &a, const pack<Type> &b) \
+{ \
+    pack<Type> output; \
+    for (int i = 0; i < pack<Type>::width; i++) \
+        output.v[i] = a.v[i] op b.v[i]; \
+    return output; \
+}
+MATRIX_PACK_OPERATOR(+)
+MATRIX_PACK_OPERATOR(-)
+MATRIX_PACK_OPERATOR(*)
+MATRIX_PACK_OPERATOR(/)
+#undef MATRIX_PACK_OPERATOR
+
+//c + a*b
+template <class Type>
+inline pack<Type> multiplyAdd(const pack<Type> &c, const pack<Type> &a, const pack<Type> &b)
+{
+    return c + a * b;
+}
+
+//c - a*b
+template <class Type>
+inline pack<Type> multiplySubtract(const pack<Type> &c, const pack<Type> &a, const pack<Type> &b)
+{
+    return c - a * b;
+}
+
+template <class Type>
+inline pack<Type> absolute(const pack<Type> &a)
+{
+    pack<Type> output;
+    for (int i = 0; i < pack<Type>::width; i++)
+        output.v[i] = (a.v[i] < 0) ? -a.v[i] : a.v[i];
+    return output;
+}
+
+template <class Type>
+inline pack<Type> greater(const pack<Type> &a, const pack<Type> &b)
+{
+    pack<Type> output;
+    for (int i = 0; i < pack<Type>::width; i++)
+        output.v[i] = (a.v[i] > b.v[i]) ? 1 : 0;
+    return output;
+}
+
+template <class Type>
+inline pack<Type> atMost(const pack<Type> &a, const pack<Type> &b)
+{
+    pack<Type> output;
+    for (int i = 0; i < pack<Type>::width; i++)
+        output.v[i] = (a.v[i] <= b.v[i]) ? 1 : 0;
+    return output;
+}
+
+template <class Type>
+inline pack<Type> isZero(const pack<Type> &a)
+{
+    pack<Type> output;
+    for (int i = 0; i < pack<Type>::width; i++)
+        output.v[i] = (a.v[i] == 0) ? 1 : 0;
+    return output;
+}
+
+//Lanes of a where mask is set, lanes of b elsewhere
+template <class Type>
+inline pack<Type> select(const pack<Type> &mask, const pack<Type> &a, const pack<Type> &b)
+{
+    pack<Type> output;
+    for (int i = 0; i < pack<Type>::width; i++)
+        output.v[i] = (mask.v[i] != 0) ? a.v[i] : b.v[i];
+    return output;
+}
+
+template <class Type>
+inline pack<Type> either(const pack<Type> &a, const pack<Type> &b)
+{
+    pack<Type> output;
+    for (int i = 0; i < pack<Type>::width; i++)
+        output.v[i] = (a.v[i] != 0 || b.v[i] != 0) ? 1 : 0;
+    return output;
+}
+
+template <class Type>
+inline bool any(const pack<Type> &mask)
+{
+    for (int i = 0; i < pack<Type>::width; i++)
+    {
+        if (mask.v[i] != 0)
+            return true;
+    }
+    return false;
+}
+
+#if defined(__AVX__)
+
+template <>
+struct pack<double>
+{
+    static const int width = 4;
+    __m256d v;
+    pack() {};
+    pack(__m256d in) : v(in) {};
+    static pack load(const double* p)
+    {
+        return _mm256_loadu_pd(p);
+    };
+    void store(double* p)const
+    {
+        _mm256_storeu_pd(p, v);
+    };
+    static pack broadcast(double x)
+    {
+        return _mm256_set1_pd(x);
+    };
+};
+
+template <>
+struct pack<float>
+{
+    static const int width = 8;
+    __m256 v;
+    pack() {};
+    pack(__m256 in) : v(in) {};
+    static pack load(const float* p)
+    {
+        return _mm256_loadu_ps(p);
+    };
+    void store(float* p)const
+    {
+        _mm256_storeu_ps(p, v);
+    };
+    static pack broadcast(float x)
+    {
+        return _mm256_set1_ps(x);
+    };
+};
+
+//Comparisons set every bit of a lane, which is what blendv and movemask look at
+#define MATRIX_PACK_AVX(Type, suffix) \
+inline pack<Type> operator+(const pack<Type> &a, const pack<Type> &b) { return _mm256_add_##suffix(a.v, b.v); } \
+inline pack<Type> operator-(const pack<Type> &a, const pack<Type> &b) { return _mm256_sub_##suffix(a.v, b.v); } \
+inline pack<Type> operator*(const pack<Type> &a, const pack<Type> &b) { return _mm256_mul_##suffix(a.v, b.v); } \
+inline pack<Type> operator/(const pack<Type> &a, const pack<Type> &b) { return _mm256_div_##suffix(a.v, b.v); } \
+inline pack<Type> absolute(const pack<Type> &a) { return _mm256_andnot_##suffix(_mm256_set1_##suffix(-0.0), a.v); } \
+inline pack<Type> greater(const pack<Type> &a, const pack<Type> &b) { return _mm256_cmp_##suffix(a.v, b.v, _CMP_GT_OQ); } \
+inline pack<Type> atMost(const pack<Type> &a, const pack<Type> &b) { return _mm256_cmp_##suffix(a.v, b.v, _CMP_LE_OQ); } \
+inline pack<Type> isZero(const pack<Type> &a) { return _mm256_cmp_##suffix(a.v, _mm256_setzero_##suffix(), _CMP_EQ_OQ); } \
+inline pack<Type> select(const pack<Type> &mask, const pack<Type> &a, const pack<Type> &b) { return _mm256_blendv_##suffix(b.v, a.v, mask.v); } \
+inline pack<Type> either(const pack<Type> &a, const pack<Type> &b) { return _mm256_or_##suffix(a.v, b.v); } \
+inline bool any(const pack<Type> &mask) { return _mm256_movemask_##suffix(mask.v) != 0; }
+MATRIX_PACK_AVX(double, pd)
+MATRIX_PACK_AVX(float, ps)
+#undef MATRIX_PACK_AVX
+
+#if defined(__FMA__)
+inline pack<double> multiplyAdd(const pack<double> &c, const pack<double> &a, const pack<double> &b)
+{
+    return _mm256_fmadd_pd(a.v, b.v, c.v);
+}
+
+inline pack<float> multiplyAdd(const pack<float> &c, const pack<float> &a, const pack<float> &b)
+{
+    return _mm256_fmadd_ps(a.v, b.v, c.v);
+}
+
+inline pack<double> multiplySubtract(const pack<double> &c, const pack<double> &a, const pack<double> &b)
+{
+    return _mm256_fnmadd_pd(a.v, b.v, c.v);
+}
+
+inline pack<float> multiplySubtract(const pack<float> &c, const pack<float> &a, const pack<float> &b)
+{
+    return _mm256_fnmadd_ps(a.v, b.v, c.v);
+}
+#endif
+
+#endif
+
+/*
+The kernels below work on one pack of lanes. Element e of the matrices in it is the pack at
+p + e*stride, so the same code runs on a batch's storage, whose stride is its padded count, and
+on a scratch copy, whose stride is one pack.
+*/
+
+//Swap rows r and s of the n column block at p, in the lanes where mask is set
+template <class Type>
+inline void swapRows(Type* p, size_t stride, int n, int r, int s, int first, const pack<Type> &mask)
+{
+    for (int j = first; j < n; j++)
+    {
+        Type* a = p + (static_cast<size_t>(r)*n + j)*stride;
+        Type* b = p + (static_cast<size_t>(s)*n + j)*stride;
+        const pack<Type> x = pack<Type>::load(a);
+        const pack<Type> y = pack<Type>::load(b);
+        select(mask, y, x).store(a);
+        select(mask, x, y).store(b);
+    }
+}
+
+//Largest size inverted by adjugate, above it matrices are eliminated
+const int cofactorLimit = 4;
+
+/*
+|A| in the max norm, the largest row sum of each lane's matrix.
+A lane is singular when a pivot is no bigger than n*eps*|A|, since rounding alone can leave a pivot
+that size where the exact one is 0.
+*/
+template <class Type>
+inline pack<Type> norm(const Type* a, size_t stride, int n)
+{
+    typedef pack<Type> P;
+    P output = P::broadcast(0);
+    for (int y = 0; y < n; y++)
+    {
+        P sum = absolute(P::load(a + static_cast<size_t>(y)*n*stride));
+        for (int x = 1; x < n; x++)
+        {
+            sum = sum + absolute(P::load(a + (static_cast<size_t>(y)*n + x)*stride));
+        }
+        output = select(greater(sum, output), sum, output);
+    }
+    return output;
+}
+
+/*
+Inverses of matrices up to 4*4 straight from the adjugate, which is the cofactor method the single
+matrix code uses at these sizes. The 4*4 cofactors are built from the six 2*2 minors of the top
+two rows and the six of the bottom two, which share most of the products.
+Each matrix is first divided by its norm, so |A|^n is never formed where it could overflow.
+The determinant alone cannot tell which lanes are singular, being a product of n pivots, so the
+caller finds them with eliminate and passes the mask in; their inverse is written as zero.
+*/
+template <class Type>
+inline void adjugate(const Type* a, size_t stride, int n, Type* out, size_t outStride, const pack<Type> &singular)
+{
+    typedef pack<Type> P;
+    const P zero = P::broadcast(0);
+    const P one = P::broadcast(1);
+    const P size = norm(a, stride, n);
+    const P scale = select(isZero(size), one, size);
+    const P unscale = one / scale;
+    //Filled to 16 whatever n is, so no branch below can read an unset element
+    P m[16];
+    for (int e = 0; e < 16; e++)
+    {
+        m[e] = (e < n*n) ? P::load(a + e*stride) * unscale : zero;
+    }
+    P c[16];
+    P det;
+    if (n == 2)
+    {
+        c[0] = m[3];
+        c[1] = P::broadcast(0) - m[1];
+        c[2] = P::broadcast(0) - m[2];
+        c[3] = m[0];
+        det = m[0] * m[3] - m[1] * m[2];
+    }
+    else if (n == 3)
+    {
+        c[0] = m[4] * m[8] - m[5] * m[7];
+        c[1] = m[2] * m[7] - m[1] * m[8];
+        c[2] = m[1] * m[5] - m[2] * m[4];
+        c[3] = m[5] * m[6] - m[3] * m[8];
+        c[4] = m[0] * m[8] - m[2] * m[6];
+        c[5] = m[2] * m[3] - m[0] * m[5];
+        c[6] = m[3] * m[7] - m[4] * m[6];
+        c[7] = m[1] * m[6] - m[0] * m[7];
+        c[8] = m[0] * m[4] - m[1] * m[3];
+        det = m[0] * c[0] + m[1] * c[3] + m[2] * c[6];
+    }
+    else
+    {
+        const P s0 = m[0] * m[5] - m[4] * m[1];
+        const P s1 = m[0] * m[6] - m[4] * m[2];
+        const P s2 = m[0] * m[7] - m[4] * m[3];
+        const P s3 = m[1] * m[6] - m[5] * m[2];
+        const P s4 = m[1] * m[7] - m[5] * m[3];
+        const P s5 = m[2] * m[7] - m[6] * m[3];
+        const P t0 = m[8] * m[13] - m[12] * m[9];
+        const P t1 = m[8] * m[14] - m[12] * m[10];
+        const P t2 = m[8] * m[15] - m[12] * m[11];
+        const P t3 = m[9] * m[14] - m[13] * m[10];
+        const P t4 = m[9] * m[15] - m[13] * m[11];
+        const P t5 = m[10] * m[15] - m[14] * m[11];
+        c[0] = m[5] * t5 - m[6] * t4 + m[7] * t3;
+        c[1] = m[2] * t4 - m[1] * t5 - m[3] * t3;
+        c[2] = m[13] * s5 - m[14] * s4 + m[15] * s3;
+        c[3] = m[10] * s4 - m[9] * s5 - m[11] * s3;
+        c[4] = m[6] * t2 - m[4] * t5 - m[7] * t1;
+        c[5] = m[0] * t5 - m[2] * t2 + m[3] * t1;
+        c[6] = m[14] * s2 - m[12] * s5 - m[15] * s1;
+        c[7] = m[8] * s5 - m[10] * s2 + m[11] * s1;
+        c[8] = m[4] * t4 - m[5] * t2 + m[7] * t0;
+        c[9] = m[1] * t2 - m[0] * t4 - m[3] * t0;
+        c[10] = m[12] * s4 - m[13] * s2 + m[15] * s0;
+        c[11] = m[9] * s2 - m[8] * s4 - m[11] * s0;
+        c[12] = m[5] * t1 - m[4] * t3 - m[6] * t0;
+        c[13] = m[0] * t3 - m[1] * t1 + m[2] * t0;
+        c[14] = m[13] * s1 - m[12] * s3 - m[14] * s0;
+        c[15] = m[8] * s3 - m[9] * s1 + m[10] * s0;
+        det = s0 * t5 - s1 * t4 + s2 * t3 + s3 * t2 - s4 * t1 + s5 * t0;
+    }
+    //(A/s)^-1 = s A^-1
+    const P inv = unscale / select(either(singular, isZero(det)), one, det);
+    for (int e = 0; e < n*n; e++)
+    {
+        select(singular, zero, c[e] * inv).store(out + e*outStride);
+    }
+}
+
+/*
+Gauss-Jordan elimination of one pack with row pivoting, on [A | I] held in work so every row
+operation runs along one contiguous strip. Every candidate row that beats the pivot so far is
+swapped into the pivot row in the lanes where it does, so when the column is done each lane has
+its own largest pivot in place, and the right half ends up as the inverse with no permutation to
+undo.
+A lane whose pivot falls under the limit given with norm is singular, it is carried through with a pivot of 1 so
+it cannot spread infinities, and its inverse is written as zero. Returns the mask of singular lanes.
+work holds 2*n*n packs.
+*/
+template <class Type>
+inline pack<Type> gaussJordan(const Type* a, size_t stride, int n, Type* out, size_t outStride, Type* work)
+{
+    typedef pack<Type> P;
+    const size_t w = P::width;
+    const int columns = 2*n;
+    const P zero = P::broadcast(0);
+    const P one = P::broadcast(1);
+    for (int y = 0; y < n; y++)
+    {
+        Type* row = work + y*columns*w;
+        for (int x = 0; x < n; x++)
+        {
+            P::load(a + (static_cast<size_t>(y)*n + x)*stride).store(row + x*w);
+            ((x == y) ? one : zero).store(row + (n + x)*w);
+        }
+    }
+    const P limit = P::broadcast(n * std::numeric_limits<Type>::epsilon()) * norm(a, stride, n);
+    P singular = zero;
+    for (int k = 0; k < n; k++)
+    {
+        P best = absolute(P::load(work + (k*columns + k)*w));
+        for (int i = k + 1; i < n; i++)
+        {
+            const P candidate = absolute(P::load(work + (i*columns + k)*w));
+            const P better = greater(candidate, best);
+            if (!any(better))
+                continue;
+            best = select(better, candidate, best);
+            swapRows(work, w, columns, k, i, k, better);
+        }
+        Type* rowK = work + k*columns*w;
+        const P pivot = P::load(rowK + k*w);
+        const P smallPivot = atMost(absolute(pivot), limit);
+        singular = either(singular, smallPivot);
+        const P divisor = select(smallPivot, one, pivot);
+        //Multipliers are divided out rather than taken from a scaled pivot row, so a row equal to
+        //the pivot row cancels exactly, and the rows below see the same arithmetic as in eliminate
+        for (int i = 0; i < n; i++)
+        {
+            if (i == k)
+                continue;
+            Type* rowI = work + i*columns*w;
+            const P f = P::load(rowI + k*w) / divisor;
+            for (int j = k + 1; j < columns; j++)
+            {
+                multiplySubtract(P::load(rowI + j*w), f, P::load(rowK + j*w)).store(rowI + j*w);
+            }
+        }
+        const P inv = one / divisor;
+        for (int j = k + 1; j < columns; j++)
+        {
+            (P::load(rowK + j*w) * inv).store(rowK + j*w);
+        }
+    }
+    for (int y = 0; y < n; y++)
+    {
+        const Type* row = work + (y*columns + n)*w;
+        for (int x = 0; x < n; x++)
+        {
+            select(singular, zero, P::load(row + x*w)).store(out + (static_cast<size_t>(y)*n + x)*outStride);
+        }
+    }
+    return singular;
+}
+
+/*
+Determinant of one pack by elimination with the same pivoting, the product of the pivots with
+the sign flipped in each lane for every row it swapped. Singular lanes come out as 0, and are
+set in singular, by the same pivot limit as gaussJordan.
+work holds n*n packs.
+*/
+template <class Type>
+inline pack<Type> eliminate(const Type* a, size_t stride, int n, Type* work, pack<Type> &singular)
+{
+    typedef pack<Type> P;
+    const size_t w = P::width;
+    const P one = P::broadcast(1);
+    for (int e = 0; e < n*n; e++)
+    {
+        P::load(a + e*stride).store(work + e*w);
+    }
+    const P limit = P::broadcast(n * std::numeric_limits<Type>::epsilon()) * norm(a, stride, n);
+    singular = P::broadcast(0);
+    P det = one;
+    for (int k = 0; k < n; k++)
+    {
+        P best = absolute(P::load(work + (k*n + k)*w));
+        for (int i = k + 1; i < n; i++)
+        {
+            const P candidate = absolute(P::load(work + (i*n + k)*w));
+            const P better = greater(candidate, best);
+            if (!any(better))
+                continue;
+            best = select(better, candidate, best);
+            det = select(better, P::broadcast(0) - det, det);
+            swapRows(work, w, n, k, i, k, better);
+        }
+        const P pivot = P::load(work + (k*n + k)*w);
+        det = det * pivot;
+        const P smallPivot = atMost(absolute(pivot), limit);
+        singular = either(singular, smallPivot);
+        const P divisor = select(smallPivot, one, pivot);
+        const Type* rowK = work + k*n*w;
+        for (int i = k + 1; i < n; i++)
+        {
+            Type* rowI = work + i*n*w;
+            const P f = P::load(rowI + k*w) / divisor;
+            for (int j = k + 1; j < n; j++)
+            {
+                multiplySubtract(P::load(rowI + j*w), f, P::load(rowK + j*w)).store(rowI + j*w);
+            }
+        }
+    }
+    return select(singular, P::broadcast(0), det);
+}
+
+}
+
+/*
+matrixBatch holds count matrices of the same width and height, element (row, col) of matrix
+index at getData()[(row*width + col)*getStride() + index]. The stride is the count padded to a
+whole number of packs, and the padding lanes are kept at zero so the kernels can run over them.
+Only float and double are supported, since the kernels exist to fill the vector units.
+*/
+template <class Type>
+class matrixBatch
+{
+public:
+    matrixBatch(int in_width, int in_height, int in_count)
+        : width(in_width), height(in_height), count(in_count)
+    {
+        static_assert(std::is_floating_point<Type>::value, "matrixBatch holds float or double");
+        if (width < 1 || height < 1 || count < 0)
+            throw matrixException(DIMENSION_ERROR);
+        const int lanes = batch::pack<Type>::width;
+        stride = (count + lanes - 1) / lanes * lanes;
+        data = allocate<Type>(elements());
+        std::memset(data, 0, elements() * sizeof(Type));
+    };
+    matrixBatch(const matrixBatch<Type> &in_batch)
+        : width(in_batch.width), height(in_batch.height), count(in_batch.count), stride(in_batch.stride)
+    {
+        data = allocate<Type>(elements());
+        std::memcpy(data, in_batch.data, elements() * sizeof(Type));
+    };
+    matrixBatch<Type>& operator=(const matrixBatch<Type> &in_batch)
+    {
+        if (this != &in_batch)
+        {
+            matrixBatch<Type> copy(in_batch);
+            swap(copy);
+        }
+        return *this;
+    };
+    ~matrixBatch()
+    {
+        release(data);
+    };
+    void swap(matrixBatch<Type> &other)
+    {
+        std::swap(width, other.width);
+        std::swap(height, other.height);
+        std::swap(count, other.count);
+        std::swap(stride, other.stride);
+        std::swap(data, other.data);
+    };
+    int getWidth()const
+    {
+        return width;
+    };
+    int getHeight()const
+    {
+        return height;
+    };
+    int getCount()const
+    {
+        return count;
+    };
+    int getStride()const
+    {
+        return stride;
+    };
+    Type* getData()const
+    {
+        return data;
+    };
+    Type& operator()(int index, int row, int col)
+    {
+#if MATRIX_BOUNDS_CHECK
+        if (index < 0 || index >= count || row < 0 || row >= height || col < 0 || col >= width)
+            throw matrixException(BOUNDS_ERROR);
+#endif
+        return data[(static_cast<size_t>(row)*width + col)*stride + index];
+    };
+    const Type& operator()(int index, int row, int col)const
+    {
+#if MATRIX_BOUNDS_CHECK
+        if (index < 0 || index >= count || row < 0 || row >= height || col < 0 || col >= width)
+            throw matrixException(BOUNDS_ERROR);
+#endif
+        return data[(static_cast<size_t>(row)*width + col)*stride + index];
+    };
+    //Copy a matrix of the batch's shape in or out of position index
+    void set(int index, const matrix<Type> &a)
+    {
+        if (a.getWidth() != width || a.getHeight() != height)
+            throw matrixException(DIMENSION_ERROR);
+        if (index < 0 || index >= count)
+            throw matrixException(BOUNDS_ERROR);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                (*this)(index, y, x) = a(y, x);
+            }
+        }
+    };
+    matrix<Type> get(int index)const
+    {
+        if (index < 0 || index >= count)
+            throw matrixException(BOUNDS_ERROR);
+        matrix<Type> output(width, height);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                output(y, x) = (*this)(index, y, x);
+            }
+        }
+        return output;
+    };
+private:
+    size_t elements()const
+    {
+        return static_cast<size_t>(width) * height * stride;
+    };
+    int width;
+    int height;
+    int count;
+    int stride;
+    Type* data;
+};
+
+namespace batch
+{
+
+//Run function(first, last) over the packs of a batch of stride lanes, with about work flops a pack
+template <class Type, class Function>
+void forPacks(int stride, int work, Function function)
+{
+    const int packs = stride / pack<Type>::width;
+    const int grain = 1 + 65536 / (work + 1);
+    threadPool::instance().parallelFor(0, packs, grain, function);
+}
+
+}
+
+/*
+Invert every matrix of a square batch into output, reusing output's storage when it already has
+the right shape, so a stream of batches can be inverted without allocating. regular[i] is set to
+1 if matrix i was inverted, and to 0 if it is singular, in which case its inverse is left as zero;
+one singular member does not stop the rest. Up to 4*4 the adjugate is used, larger matrices are
+eliminated with row pivoting; either way a member is singular when a pivot of the pivoted
+elimination is no bigger than n*eps*|A|.
+If the matrices are not square, dimension error is thrown. output may not be a.
+*/
+template <class Type>
+void invertInto(const matrixBatch<Type> &a, matrixBatch<Type> &output, std::vector<char> &regular)
+{
+    typedef batch::pack<Type> P;
+    const int n = a.getWidth();
+    const int count = a.getCount();
+    if (n != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    if (&output == &a)
+        throw matrixException(OTHER);
+    if (output.getWidth() != n || output.getHeight() != n || output.getCount() != count)
+    {
+        matrixBatch<Type> fresh(n, n, count);
+        output.swap(fresh);
+    }
+    regular.resize(count);
+    const size_t stride = a.getStride();
+    const Type* in = a.getData();
+    Type* out = output.getData();
+    batch::forPacks<Type>(a.getStride(), 2*n*n*n, [&](int first, int last)
+    {
+        std::vector<Type> work(2*static_cast<size_t>(n)*n*P::width);
+        Type singular[P::width];
+        for (int b = first; b < last; b++)
+        {
+            const size_t lane = static_cast<size_t>(b)*P::width;
+            if (n == 1)
+            {
+                const P x = P::load(in + lane);
+                const P zero = isZero(x);
+                select(zero, P::broadcast(0), P::broadcast(1) / select(zero, P::broadcast(1), x)).store(out + lane);
+                zero.store(singular);
+            }
+            else if (n <= batch::cofactorLimit)
+            {
+                P mask;
+                batch::eliminate(in + lane, stride, n, work.data(), mask);
+                batch::adjugate(in + lane, stride, n, out + lane, stride, mask);
+                mask.store(singular);
+            }
+            else
+            {
+                batch::gaussJordan(in + lane, stride, n, out + lane, stride, work.data()).store(singular);
+            }
+            for (int i = 0; i < P::width && lane + i < static_cast<size_t>(count); i++)
+            {
+                regular[lane + i] = (singular[i] != 0) ? 0 : 1;
+            }
+        }
+    });
+}
+
+//As invertInto, returning a new batch
+template <class Type>
+matrixBatch<Type> invert(const matrixBatch<Type> &a, std::vector<char> &regular)
+{
+    matrixBatch<Type> output(a.getWidth(), a.getHeight(), a.getCount());
+    invertInto(a, output, regular);
+    return output;
+}
+
+/*
+Determinant of every matrix of a square batch, by elimination with row pivoting. It is 0 for
+exactly the members invert reports singular.
+*/
+template <class Type>
+std::vector<Type> determinant(const matrixBatch<Type> &a)
+{
+    typedef batch::pack<Type> P;
+    const int n = a.getWidth();
+    if (n != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    std::vector<Type> output(a.getStride());
+    const size_t stride = a.getStride();
+    const Type* in = a.getData();
+    batch::forPacks<Type>(a.getStride(), n*n*n, [&](int first, int last)
+    {
+        std::vector<Type> work(static_cast<size_t>(n)*n*P::width);
+        for (int b = first; b < last; b++)
+        {
+            const size_t lane = static_cast<size_t>(b)*P::width;
+            P singular;
+            if (n == 1)
+                P::load(in + lane).store(output.data() + lane);
+            else
+                batch::eliminate(in + lane, stride, n, work.data(), singular).store(output.data() + lane);
+        }
+    });
+    output.resize(a.getCount());
+    return output;
+}
+
+/*
+Product of corresponding members, an m*n batch times an n*p batch of the same count gives an m*p
+batch, written to output and reusing its storage when it already has the right shape.
+If the shapes or the counts do not match, dimension error is thrown. output may not be a or b.
+*/
+template <class Type>
+void multiplyInto(const matrixBatch<Type> &a, const matrixBatch<Type> &b, matrixBatch<Type> &output)
+{
+    typedef batch::pack<Type> P;
+    if (a.getWidth() != b.getHeight() || a.getCount() != b.getCount())
+        throw matrixException(DIMENSION_ERROR);
+    if (&output == &a || &output == &b)
+        throw matrixException(OTHER);
+    const int m = a.getHeight();
+    const int n = a.getWidth();
+    const int p = b.getWidth();
+    if (output.getWidth() != p || output.getHeight() != m || output.getCount() != a.getCount())
+    {
+        matrixBatch<Type> fresh(p, m, a.getCount());
+        output.swap(fresh);
+    }
+    const size_t stride = a.getStride();
+    const Type* aData = a.getData();
+    const Type* bData = b.getData();
+    Type* out = output.getData();
+    batch::forPacks<Type>(a.getStride(), 2*m*n*p, [&](int first, int last)
+    {
+        for (int blk = first; blk < last; blk++)
+        {
+            const size_t lane = static_cast<size_t>(blk)*P::width;
+            for (int y = 0; y < m; y++)
+            {
+                const Type* aRow = aData + static_cast<size_t>(y)*n*stride + lane;
+                for (int x = 0; x < p; x++)
+                {
+                    P sum = P::load(aRow) * P::load(bData + static_cast<size_t>(x)*stride + lane);
+                    for (int k = 1; k < n; k++)
+                    {
+                        sum = multiplyAdd(sum, P::load(aRow + k*stride), P::load(bData + (static_cast<size_t>(k)*p + x)*stride + lane));
+                    }
+                    sum.store(out + (static_cast<size_t>(y)*p + x)*stride + lane);
+                }
+            }
+        }
+    });
+}
+
+//As multiplyInto, returning a new batch
+template <class Type>
+matrixBatch<Type> operator*(const matrixBatch<Type> &a, const matrixBatch<Type> &b)
+{
+    matrixBatch<Type> output(b.getWidth(), a.getHeight(), a.getCount());
+    multiplyInto(a, b, output);
+    return output;
+}
+
+}
+
+#endif
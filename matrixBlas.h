@@ -0,0 +1,299 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_BLAS_H
+#define MATRIX_BLAS_H
+
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include "matrixError.h"
+
+/*
+Build with MATRIX_USE_BLAS=1 (make blas) to hand float and double products, transposes,
+inverses, determinants and LU solves to CBLAS and LAPACK. Other element types, and every type
+when the flag is off, keep the native templates.
+*/
+#ifndef MATRIX_USE_BLAS
+#define MATRIX_USE_BLAS 0
+#endif
+
+#if MATRIX_USE_BLAS
+#include <cblas.h>
+
+//LAPACK's Fortran interface, every argument by pointer and matrices column major
+extern "C"
+{
+    void dgetrf_(const int* m, const int* n, double* a, const int* lda, int* ipiv, int* info);
+    void dgetri_(const int* n, double* a, const int* lda, const int* ipiv, double* work, const int* lwork, int* info);
+}
+#endif
+
+namespace Matrix
+{
+
+namespace blas
+{
+
+//True if the library was built with a BLAS backend
+inline bool available()
+{
+    return MATRIX_USE_BLAS != 0;
+}
+
+/*
+The runtime switch. The backend starts enabled unless MATRIX_BLAS=0 is set, and can be turned
+off and on at any time, e.g. to compare the two paths on the same inputs.
+*/
+inline bool& enabledFlag()
+{
+    static bool enabled = []()
+    {
+        const char* env = std::getenv("MATRIX_BLAS");
+        return !(env && std::atoi(env) == 0);
+    }();
+    return enabled;
+}
+
+inline bool enabled()
+{
+    return available() && enabledFlag();
+}
+
+inline void setEnabled(bool on)
+{
+    enabledFlag() = on;
+}
+
+/*
+routines<Type> is what the matrix code dispatches through. Every member returns true if it
+handled the call, so the generic version, which handles nothing, sends every type back to the
+native code. Matrices are row major with a stride, as matrix stores them.
+*/
+template <class Type>
+struct routines
+{
+    //c (m x n) = a (m x k) * b (k x n)
+    static bool multiply(const Type*, int, const Type*, int, Type*, int, int, int, int)
+    {
+        return false;
+    };
+    //b (cols x rows) = transpose of a (rows x cols)
+    static bool transpose(const Type*, int, Type*, int, int, int)
+    {
+        return false;
+    };
+    //out (n x n, double) = inverse of a, math error if a is singular
+    static bool invert(const Type*, int, double*, int, int)
+    {
+        return false;
+    };
+    static bool determinant(const Type*, int, int, Type&)
+    {
+        return false;
+    };
+    //In place row pivoted LU of a double matrix, pivot[k] is the row swapped with k at step k
+    static bool factor(Type*, int, int, int*, int&)
+    {
+        return false;
+    };
+    //Overwrite b (n x columns) with the solution of LU x = P b
+    static bool solve(const Type*, int, const int*, int, Type*, int, int)
+    {
+        return false;
+    };
+};
+
+#if MATRIX_USE_BLAS
+
+namespace lapack
+{
+
+/*
+Factor the n x n column major matrix a in place, pivot comes back 0 based.
+Returns the number of row swaps, or -1 if a is singular.
+*/
+inline int factor(double* a, int lda, int n, int* pivot)
+{
+    int info = 0;
+    dgetrf_(&n, &n, a, &lda, pivot, &info);
+    if (info < 0)
+        throw matrixException(OTHER);
+    int swaps = 0;
+    for (int i = 0; i < n; i++)
+    {
+        pivot[i]--;
+        if (pivot[i] != i)
+            swaps++;
+    }
+    return (info > 0) ? -1 : swaps;
+}
+
+/*
+A row major matrix is the column major storage of its transpose, and inverting a transpose gives
+the transpose of the inverse, so a row major inverse needs no reordering at all.
+*/
+inline void invert(double* a, int lda, int n)
+{
+    std::vector<int> pivot(n);
+    if (factor(a, lda, n, pivot.data()) < 0)
+        throw matrixException(MATH_ERROR);
+    for (int i = 0; i < n; i++)
+        pivot[i]++;
+    int info = 0;
+    int lwork = -1;
+    double query = 0;
+    dgetri_(&n, a, &lda, pivot.data(), &query, &lwork, &info);
+    lwork = static_cast<int>(query);
+    if (lwork < n)
+        lwork = n;
+    std::vector<double> work(lwork);
+    dgetri_(&n, a, &lda, pivot.data(), work.data(), &lwork, &info);
+    if (info != 0)
+        throw matrixException(MATH_ERROR);
+}
+
+//The determinant of a matrix and its transpose are the same, so storage order does not matter
+inline double determinant(double* a, int lda, int n)
+{
+    std::vector<int> pivot(n);
+    int swaps = factor(a, lda, n, pivot.data());
+    if (swaps < 0)
+        return 0.0;
+    double output = (swaps % 2) ? -1.0 : 1.0;
+    for (int i = 0; i < n; i++)
+        output *= a[static_cast<size_t>(i) * lda + i];
+    return output;
+}
+
+template <class Type>
+void copy(const Type* a, int lda, double* out, int ldo, int n)
+{
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+            out[static_cast<size_t>(y) * ldo + x] = a[static_cast<size_t>(y) * lda + x];
+    }
+}
+
+}
+
+template <>
+struct routines<double>
+{
+    static bool multiply(const double* a, int lda, const double* b, int ldb, double* c, int ldc, int m, int n, int k)
+    {
+        if (!enabled())
+            return false;
+        cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0, a, lda, b, ldb, 0.0, c, ldc);
+        return true;
+    };
+    static bool transpose(const double* a, int lda, double* b, int ldb, int rows, int cols)
+    {
+        if (!enabled())
+            return false;
+        cblas_domatcopy(CblasRowMajor, CblasTrans, rows, cols, 1.0, a, lda, b, ldb);
+        return true;
+    };
+    static bool invert(const double* a, int lda, double* out, int ldo, int n)
+    {
+        if (!enabled())
+            return false;
+        lapack::copy(a, lda, out, ldo, n);
+        lapack::invert(out, ldo, n);
+        return true;
+    };
+    static bool determinant(const double* a, int lda, int n, double &out)
+    {
+        if (!enabled())
+            return false;
+        std::vector<double> work(static_cast<size_t>(n) * n);
+        lapack::copy(a, lda, work.data(), n, n);
+        out = lapack::determinant(work.data(), n, n);
+        return true;
+    };
+    /*
+    LAPACK factors column major, so the row major matrix is transposed into a work array,
+    factored, and transposed back.
+    */
+    static bool factor(double* a, int lda, int n, int* pivot, int &sign)
+    {
+        if (!enabled())
+            return false;
+        std::vector<double> work(static_cast<size_t>(n) * n);
+        cblas_domatcopy(CblasRowMajor, CblasTrans, n, n, 1.0, a, lda, work.data(), n);
+        int swaps = lapack::factor(work.data(), n, n, pivot);
+        if (swaps < 0)
+            throw matrixException(MATH_ERROR);
+        cblas_domatcopy(CblasRowMajor, CblasTrans, n, n, 1.0, work.data(), n, a, lda);
+        sign = (swaps % 2) ? -1 : 1;
+        return true;
+    };
+    static bool solve(const double* lu, int ldlu, const int* pivot, int n, double* b, int ldb, int columns)
+    {
+        if (!enabled())
+            return false;
+        for (int k = 0; k < n; k++)
+        {
+            if (pivot[k] != k)
+                cblas_dswap(columns, b + static_cast<size_t>(k) * ldb, 1, b + static_cast<size_t>(pivot[k]) * ldb, 1);
+        }
+        cblas_dtrsm(CblasRowMajor, CblasLeft, CblasLower, CblasNoTrans, CblasUnit, n, columns, 1.0, lu, ldlu, b, ldb);
+        cblas_dtrsm(CblasRowMajor, CblasLeft, CblasUpper, CblasNoTrans, CblasNonUnit, n, columns, 1.0, lu, ldlu, b, ldb);
+        return true;
+    };
+};
+
+template <>
+struct routines<float>
+{
+    static bool multiply(const float* a, int lda, const float* b, int ldb, float* c, int ldc, int m, int n, int k)
+    {
+        if (!enabled())
+            return false;
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k, 1.0f, a, lda, b, ldb, 0.0f, c, ldc);
+        return true;
+    };
+    static bool transpose(const float* a, int lda, float* b, int ldb, int rows, int cols)
+    {
+        if (!enabled())
+            return false;
+        cblas_somatcopy(CblasRowMajor, CblasTrans, rows, cols, 1.0f, a, lda, b, ldb);
+        return true;
+    };
+    //invert always returns double, so a float matrix is widened and inverted in double
+    static bool invert(const float* a, int lda, double* out, int ldo, int n)
+    {
+        if (!enabled())
+            return false;
+        lapack::copy(a, lda, out, ldo, n);
+        lapack::invert(out, ldo, n);
+        return true;
+    };
+    static bool determinant(const float* a, int lda, int n, float &out)
+    {
+        if (!enabled())
+            return false;
+        std::vector<double> work(static_cast<size_t>(n) * n);
+        lapack::copy(a, lda, work.data(), n, n);
+        out = static_cast<float>(lapack::determinant(work.data(), n, n));
+        return true;
+    };
+    static bool factor(float*, int, int, int*, int&)
+    {
+        return false;
+    };
+    static bool solve(const float*, int, const int*, int, float*, int, int)
+    {
+        return false;
+    };
+};
+
+#endif
+
+}
+
+}
+
+#endif
@@ -2,6 +2,9 @@
 Written by Andrew M. Hal
 */
 
+#ifndef MATRIX_ERROR_H
+#define MATRIX_ERROR_H
+
 #include <string>
 
 namespace Matrix{
@@ -11,7 +14,9 @@ namespace Matrix{
 		DIMENSION_ERROR,
 		MEMORY_ERROR,
 		BOUNDS_ERROR,
-		OTHER
+		OTHER,
+		IO_ERROR,
+		CANCELLED_ERROR
 	};
 
 	class matrixException {
@@ -42,13 +47,21 @@ namespace Matrix{
 				break;
 			case OTHER:
 				errorMessage = "An error occured during matrix operation";
+				break;
+			case IO_ERROR:
+				errorMessage = "Matrix error occured when reading or writing a scratch file";
+				break;
+			case CANCELLED_ERROR:
+				errorMessage = "Matrix operation was cancelled before it finished";
 			}
 		}
-		std::string getErrorMessage(){
+		std::string getErrorMessage()const{
 			return errorMessage;
 		}
-		possible_errors getErrorCode(){
+		possible_errors getErrorCode()const{
 			return errorCode;
 		}
 	};
 }
+
+#endif
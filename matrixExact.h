@@ -0,0 +1,872 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_EXACT_H
+#define MATRIX_EXACT_H
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
+#include "matrix.h"
+
+namespace Matrix
+{
+
+/*
+An arbitrary precision integer, sign and magnitude with the magnitude in base 2^32 limbs, least
+significant first and with no leading zero limbs, so zero has no limbs at all.
+It has what exact inversion needs: the ring operations, division with remainder, and cheap
+operations by a single word for the Chinese remainder loop.
+*/
+class bigInteger
+{
+public:
+    bigInteger() : negative(false) {};
+    bigInteger(long long value);
+    bool isZero()const
+    {
+        return limbs.empty();
+    };
+    bool isNegative()const
+    {
+        return negative;
+    };
+    void swap(bigInteger &b)
+    {
+        std::swap(negative, b.negative);
+        limbs.swap(b.limbs);
+    };
+    bigInteger operator-()const;
+    bigInteger& operator+=(const bigInteger &b);
+    bigInteger& operator-=(const bigInteger &b);
+    bigInteger& operator*=(const bigInteger &b);
+    //|x| = |x| * m + a
+    void multiplyAdd(unsigned int m, unsigned int a);
+    //|x| = |x| + |b| * m
+    void addMultiple(const bigInteger &b, unsigned int m);
+    //|x| mod m
+    unsigned int modulo(unsigned int m)const;
+    //Truncating division, as for the built in integers. Math error if b is zero.
+    static void divide(const bigInteger &a, const bigInteger &b, bigInteger &quotient, bigInteger &remainder);
+    std::string toString()const;
+    friend bool operator==(const bigInteger &a, const bigInteger &b);
+    friend bool operator<(const bigInteger &a, const bigInteger &b);
+private:
+    typedef std::vector<unsigned int> magnitude;
+    static int compare(const magnitude &a, const magnitude &b);
+    static void add(magnitude &a, const magnitude &b);
+    //a = a - b, for a >= b
+    static void subtract(magnitude &a, const magnitude &b);
+    static unsigned int divideSmall(magnitude &a, unsigned int d);
+    void trim();
+    bool negative;
+    magnitude limbs;
+};
+
+inline bigInteger::bigInteger(long long value) : negative(value < 0)
+{
+    unsigned long long m = negative ? 0ull - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+    while (m)
+    {
+        limbs.push_back(static_cast<unsigned int>(m));
+        m >>= 32;
+    }
+}
+
+inline void bigInteger::trim()
+{
+    while (!limbs.empty() && limbs.back() == 0)
+        limbs.pop_back();
+    if (limbs.empty())
+        negative = false;
+}
+
+inline int bigInteger::compare(const magnitude &a, const magnitude &b)
+{
+    if (a.size() != b.size())
+        return (a.size() < b.size()) ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;)
+    {
+        if (a[i] != b[i])
+            return (a[i] < b[i]) ? -1 : 1;
+    }
+    return 0;
+}
+
+inline void bigInteger::add(magnitude &a, const magnitude &b)
+{
+    if (a.size() < b.size())
+        a.resize(b.size(), 0);
+    unsigned long long carry = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        carry += static_cast<unsigned long long>(a[i]) + (i < b.size() ? b[i] : 0);
+        a[i] = static_cast<unsigned int>(carry);
+        carry >>= 32;
+        if (!carry && i >= b.size())
+            break;
+    }
+    if (carry)
+        a.push_back(static_cast<unsigned int>(carry));
+}
+
+inline void bigInteger::subtract(magnitude &a, const magnitude &b)
+{
+    long long borrow = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        long long t = static_cast<long long>(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = (t < 0) ? 1 : 0;
+        a[i] = static_cast<unsigned int>(t);
+        if (!borrow && i >= b.size())
+            break;
+    }
+    while (!a.empty() && a.back() == 0)
+        a.pop_back();
+}
+
+//a = a / d, returning the remainder
+inline unsigned int bigInteger::divideSmall(magnitude &a, unsigned int d)
+{
+    unsigned long long r = 0;
+    for (size_t i = a.size(); i-- > 0;)
+    {
+        r = (r << 32) | a[i];
+        a[i] = static_cast<unsigned int>(r / d);
+        r %= d;
+    }
+    while (!a.empty() && a.back() == 0)
+        a.pop_back();
+    return static_cast<unsigned int>(r);
+}
+
+inline bigInteger bigInteger::operator-()const
+{
+    bigInteger output(*this);
+    if (!output.isZero())
+        output.negative = !negative;
+    return output;
+}
+
+inline bigInteger& bigInteger::operator+=(const bigInteger &b)
+{
+    if (negative == b.negative)
+    {
+        add(limbs, b.limbs);
+    }
+    else if (compare(limbs, b.limbs) >= 0)
+    {
+        subtract(limbs, b.limbs);
+    }
+    else
+    {
+        magnitude larger(b.limbs);
+        subtract(larger, limbs);
+        limbs.swap(larger);
+        negative = b.negative;
+    }
+    trim();
+    return *this;
+}
+
+inline bigInteger& bigInteger::operator-=(const bigInteger &b)
+{
+    return *this += -b;
+}
+
+inline bigInteger& bigInteger::operator*=(const bigInteger &b)
+{
+    if (isZero() || b.isZero())
+    {
+        limbs.clear();
+        negative = false;
+        return *this;
+    }
+    magnitude output(limbs.size() + b.limbs.size(), 0);
+    for (size_t i = 0; i < limbs.size(); i++)
+    {
+        unsigned long long carry = 0;
+        for (size_t j = 0; j < b.limbs.size(); j++)
+        {
+            carry += static_cast<unsigned long long>(limbs[i]) * b.limbs[j] + output[i + j];
+            output[i + j] = static_cast<unsigned int>(carry);
+            carry >>= 32;
+        }
+        output[i + b.limbs.size()] = static_cast<unsigned int>(carry);
+    }
+    limbs.swap(output);
+    negative = (negative != b.negative);
+    trim();
+    return *this;
+}
+
+inline void bigInteger::multiplyAdd(unsigned int m, unsigned int a)
+{
+    unsigned long long carry = a;
+    for (size_t i = 0; i < limbs.size(); i++)
+    {
+        carry += static_cast<unsigned long long>(limbs[i]) * m;
+        limbs[i] = static_cast<unsigned int>(carry);
+        carry >>= 32;
+    }
+    if (carry)
+        limbs.push_back(static_cast<unsigned int>(carry));
+    trim();
+}
+
+inline void bigInteger::addMultiple(const bigInteger &b, unsigned int m)
+{
+    if (m == 0 || b.isZero())
+        return;
+    if (limbs.size() < b.limbs.size())
+        limbs.resize(b.limbs.size(), 0);
+    unsigned long long carry = 0;
+    size_t i = 0;
+    for (; i < b.limbs.size(); i++)
+    {
+        carry += static_cast<unsigned long long>(b.limbs[i]) * m + limbs[i];
+        limbs[i] = static_cast<unsigned int>(carry);
+        carry >>= 32;
+    }
+    for (; carry && i < limbs.size(); i++)
+    {
+        carry += limbs[i];
+        limbs[i] = static_cast<unsigned int>(carry);
+        carry >>= 32;
+    }
+    if (carry)
+        limbs.push_back(static_cast<unsigned int>(carry));
+}
+
+inline unsigned int bigInteger::modulo(unsigned int m)const
+{
+    unsigned long long r = 0;
+    for (size_t i = limbs.size(); i-- > 0;)
+    {
+        r = ((r << 32) | limbs[i]) % m;
+    }
+    return static_cast<unsigned int>(r);
+}
+
+/*
+Long division by Knuth's algorithm D. Both operands are shifted so the divisor's top limb has its
+high bit set, which makes each estimated quotient limb at most two too big.
+*/
+inline void bigInteger::divide(const bigInteger &a, const bigInteger &b, bigInteger &quotient, bigInteger &remainder)
+{
+    if (b.isZero())
+        throw matrixException(MATH_ERROR);
+    const bool quotientNegative = (a.negative != b.negative);
+    const bool remainderNegative = a.negative;
+    if (compare(a.limbs, b.limbs) < 0)
+    {
+        remainder = a;
+        quotient = bigInteger();
+        return;
+    }
+    magnitude q;
+    magnitude r;
+    if (b.limbs.size() == 1)
+    {
+        q = a.limbs;
+        unsigned int rest = divideSmall(q, b.limbs[0]);
+        if (rest)
+            r.push_back(rest);
+    }
+    else
+    {
+        const size_t n = b.limbs.size();
+        const size_t m = a.limbs.size() - n;
+        int shift = 0;
+        while (!(b.limbs[n - 1] & (0x80000000u >> shift)))
+            shift++;
+        magnitude v(n), u(a.limbs.size() + 1, 0);
+        for (size_t i = n; i-- > 0;)
+        {
+            v[i] = (b.limbs[i] << shift) | ((shift && i) ? b.limbs[i - 1] >> (32 - shift) : 0);
+        }
+        u[a.limbs.size()] = shift ? a.limbs.back() >> (32 - shift) : 0;
+        for (size_t i = a.limbs.size(); i-- > 0;)
+        {
+            u[i] = (a.limbs[i] << shift) | ((shift && i) ? a.limbs[i - 1] >> (32 - shift) : 0);
+        }
+        q.assign(m + 1, 0);
+        const unsigned long long base = 1ull << 32;
+        for (size_t j = m + 1; j-- > 0;)
+        {
+            unsigned long long top = (static_cast<unsigned long long>(u[j + n]) << 32) | u[j + n - 1];
+            unsigned long long qhat = top / v[n - 1];
+            unsigned long long rhat = top % v[n - 1];
+            while (qhat >= base || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2]))
+            {
+                qhat--;
+                rhat += v[n - 1];
+                if (rhat >= base)
+                    break;
+            }
+            long long borrow = 0;
+            unsigned long long carry = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                unsigned long long p = qhat * v[i] + carry;
+                carry = p >> 32;
+                long long t = static_cast<long long>(u[i + j]) - borrow - static_cast<long long>(p & 0xffffffffull);
+                u[i + j] = static_cast<unsigned int>(t);
+                borrow = (t < 0) ? 1 : 0;
+            }
+            long long t = static_cast<long long>(u[j + n]) - borrow - static_cast<long long>(carry);
+            u[j + n] = static_cast<unsigned int>(t);
+            //The estimate was one too big, add the divisor back
+            if (t < 0)
+            {
+                qhat--;
+                carry = 0;
+                for (size_t i = 0; i < n; i++)
+                {
+                    carry += static_cast<unsigned long long>(u[i + j]) + v[i];
+                    u[i + j] = static_cast<unsigned int>(carry);
+                    carry >>= 32;
+                }
+                u[j + n] += static_cast<unsigned int>(carry);
+            }
+            q[j] = static_cast<unsigned int>(qhat);
+        }
+        r.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            r[i] = (u[i] >> shift) | (shift ? u[i + 1] << (32 - shift) : 0);
+        }
+    }
+    quotient.limbs.swap(q);
+    quotient.negative = quotientNegative;
+    quotient.trim();
+    remainder.limbs.swap(r);
+    remainder.negative = remainderNegative;
+    remainder.trim();
+}
+
+//Decimal, nine digits at a time
+inline std::string bigInteger::toString()const
+{
+    if (isZero())
+        return "0";
+    magnitude m(limbs);
+    std::vector<unsigned int> chunks;
+    while (!m.empty())
+    {
+        chunks.push_back(divideSmall(m, 1000000000u));
+    }
+    std::string output = negative ? "-" : "";
+    output += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;)
+    {
+        std::string digits = std::to_string(chunks[i]);
+        output.append(9 - digits.size(), '0');
+        output += digits;
+    }
+    return output;
+}
+
+inline bool operator==(const bigInteger &a, const bigInteger &b)
+{
+    return a.negative == b.negative && a.limbs == b.limbs;
+}
+
+inline bool operator!=(const bigInteger &a, const bigInteger &b)
+{
+    return !(a == b);
+}
+
+inline bool operator<(const bigInteger &a, const bigInteger &b)
+{
+    if (a.negative != b.negative)
+        return a.negative;
+    int c = bigInteger::compare(a.limbs, b.limbs);
+    return a.negative ? (c > 0) : (c < 0);
+}
+
+inline bigInteger operator+(bigInteger a, const bigInteger &b)
+{
+    return a += b;
+}
+
+inline bigInteger operator-(bigInteger a, const bigInteger &b)
+{
+    return a -= b;
+}
+
+inline bigInteger operator*(bigInteger a, const bigInteger &b)
+{
+    return a *= b;
+}
+
+inline bigInteger operator/(const bigInteger &a, const bigInteger &b)
+{
+    bigInteger q, r;
+    bigInteger::divide(a, b, q, r);
+    return q;
+}
+
+inline bigInteger operator%(const bigInteger &a, const bigInteger &b)
+{
+    bigInteger q, r;
+    bigInteger::divide(a, b, q, r);
+    return r;
+}
+
+//Non negative greatest common divisor, by Euclid
+inline bigInteger gcd(bigInteger a, bigInteger b)
+{
+    if (a.isNegative())
+        a = -a;
+    if (b.isNegative())
+        b = -b;
+    while (!b.isZero())
+    {
+        bigInteger r = a % b;
+        a.swap(b);
+        b.swap(r);
+    }
+    return a;
+}
+
+inline std::ostream& operator<<(std::ostream &out, const bigInteger &a)
+{
+    return out << a.toString();
+}
+
+/*
+Arithmetic modulo a prime p < 2^26, carried in doubles. Residues are below 2^26, so the product
+of two is below 2^52 and exact in a double's mantissa, and reducing it needs only a multiply by
+1/p, a floor and a multiply-subtract: operations that vectorise, where 64 bit integer division
+does not.
+*/
+namespace modular
+{
+
+const unsigned int primeLimit = 1u << 26;
+
+//The largest prime below p, by trial division (the divisors stop at 2^13)
+inline unsigned int previousPrime(unsigned int p)
+{
+    for (unsigned int c = (p - 1) | 1; c >= 3; c -= 2)
+    {
+        if (c >= p)
+            continue;
+        bool prime = true;
+        for (unsigned int d = 3; d * d <= c; d += 2)
+        {
+            if (c % d == 0)
+            {
+                prime = false;
+                break;
+            }
+        }
+        if (prime)
+            return c;
+    }
+    return 2;
+}
+
+//a^-1 mod p by the extended Euclidean algorithm, a must not be 0 mod p
+inline unsigned int inverse(unsigned int a, unsigned int p)
+{
+    long long t = 0, newT = 1;
+    long long r = p, newR = a % p;
+    while (newR)
+    {
+        long long q = r / newR;
+        long long tmp = t - q * newT;
+        t = newT;
+        newT = tmp;
+        tmp = r - q * newR;
+        r = newR;
+        newR = tmp;
+    }
+    return static_cast<unsigned int>((t < 0) ? t + p : t);
+}
+
+//r mod p for an integer valued |r| < 2^52, the estimated quotient may be one out either way
+inline double reduce(double r, double p, double pinv)
+{
+    r -= std::floor(r * pinv) * p;
+    if (r < 0)
+        r += p;
+    if (r >= p)
+        r -= p;
+    return r;
+}
+
+/*
+row = row - f * pivot (mod p) over n entries. With f = p - g this is also row = row + g * pivot,
+and with row all zero it scales pivot.
+*/
+inline void eliminate(double* row, const double* pivot, double f, double p, double pinv, int n)
+{
+    int x = 0;
+#if defined(__AVX__)
+    const __m256d vf = _mm256_set1_pd(f);
+    const __m256d vp = _mm256_set1_pd(p);
+    const __m256d vpinv = _mm256_set1_pd(pinv);
+    const __m256d zero = _mm256_setzero_pd();
+    for (; x + 4 <= n; x += 4)
+    {
+        __m256d r = _mm256_sub_pd(_mm256_loadu_pd(row + x), _mm256_mul_pd(vf, _mm256_loadu_pd(pivot + x)));
+        r = _mm256_sub_pd(r, _mm256_mul_pd(_mm256_floor_pd(_mm256_mul_pd(r, vpinv)), vp));
+        r = _mm256_add_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, zero, _CMP_LT_OQ), vp));
+        r = _mm256_sub_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, vp, _CMP_GE_OQ), vp));
+        _mm256_storeu_pd(row + x, r);
+    }
+#endif
+    for (; x < n; x++)
+    {
+        row[x] = reduce(row[x] - f * pivot[x], p, pinv);
+    }
+}
+
+//row = f * row (mod p)
+inline void scale(double* row, double f, double p, double pinv, int n)
+{
+    int x = 0;
+#if defined(__AVX__)
+    const __m256d vf = _mm256_set1_pd(f);
+    const __m256d vp = _mm256_set1_pd(p);
+    const __m256d vpinv = _mm256_set1_pd(pinv);
+    for (; x + 4 <= n; x += 4)
+    {
+        __m256d r = _mm256_mul_pd(vf, _mm256_loadu_pd(row + x));
+        r = _mm256_sub_pd(r, _mm256_mul_pd(_mm256_floor_pd(_mm256_mul_pd(r, vpinv)), vp));
+        r = _mm256_add_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_LT_OQ), vp));
+        r = _mm256_sub_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, vp, _CMP_GE_OQ), vp));
+        _mm256_storeu_pd(row + x, r);
+    }
+#endif
+    for (; x < n; x++)
+    {
+        row[x] = reduce(f * row[x], p, pinv);
+    }
+}
+
+//y = y * m + v (mod p), with the v given as 32 bit residues
+inline void multiplyAdd(double* y, double m, const unsigned int* v, double p, double pinv, int n)
+{
+    int x = 0;
+#if defined(__AVX__)
+    const __m256d vm = _mm256_set1_pd(m);
+    const __m256d vp = _mm256_set1_pd(p);
+    const __m256d vpinv = _mm256_set1_pd(pinv);
+    for (; x + 4 <= n; x += 4)
+    {
+        //Residues are below 2^26, so reading them as signed is safe
+        __m256d add = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x)));
+        __m256d r = _mm256_add_pd(_mm256_mul_pd(vm, _mm256_loadu_pd(y + x)), add);
+        r = _mm256_sub_pd(r, _mm256_mul_pd(_mm256_floor_pd(_mm256_mul_pd(r, vpinv)), vp));
+        r = _mm256_add_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_LT_OQ), vp));
+        r = _mm256_sub_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, vp, _CMP_GE_OQ), vp));
+        _mm256_storeu_pd(y + x, r);
+    }
+#endif
+    for (; x < n; x++)
+    {
+        y[x] = reduce(m * y[x] + v[x], p, pinv);
+    }
+}
+
+/*
+Invert the n*n row major block a modulo p in place by Gauss-Jordan elimination, setting det to
+the determinant mod p. Any non zero pivot is exact, so the first one in the column is taken.
+Returns false if a is singular mod p, leaving it undefined.
+*/
+inline bool invert(double* a, int n, unsigned int prime, unsigned int &det)
+{
+    const double p = prime;
+    const double pinv = 1.0 / p;
+    std::vector<int> pivot(n);
+    unsigned long long d = 1;
+    for (int k = 0; k < n; k++)
+    {
+        int r = k;
+        while (r < n && a[static_cast<size_t>(r)*n + k] == 0.0)
+            r++;
+        if (r == n)
+            return false;
+        pivot[k] = r;
+        double* rowK = a + static_cast<size_t>(k)*n;
+        if (r != k)
+        {
+            std::swap_ranges(rowK, rowK + n, a + static_cast<size_t>(r)*n);
+            d = (d == 0) ? 0 : prime - d;
+        }
+        const unsigned int value = static_cast<unsigned int>(rowK[k]);
+        d = d * value % prime;
+        rowK[k] = 1.0;
+        scale(rowK, inverse(value, prime), p, pinv, n);
+        for (int i = 0; i < n; i++)
+        {
+            double* rowI = a + static_cast<size_t>(i)*n;
+            const double f = rowI[k];
+            if (i == k || f == 0.0)
+                continue;
+            rowI[k] = 0.0;
+            eliminate(rowI, rowK, f, p, pinv, n);
+        }
+    }
+    for (int k = n - 1; k >= 0; k--)
+    {
+        if (pivot[k] == k)
+            continue;
+        for (int y = 0; y < n; y++)
+        {
+            std::swap(a[static_cast<size_t>(y)*n + k], a[static_cast<size_t>(y)*n + pivot[k]]);
+        }
+    }
+    det = static_cast<unsigned int>(d);
+    return true;
+}
+
+}
+
+/*
+The exact inverse of an integer matrix, as an integer matrix of numerators over one positive
+common denominator, in lowest terms.
+*/
+class exactInverse
+{
+public:
+    exactInverse(int in_n, const bigInteger &in_denominator, std::vector<bigInteger> &in_numerators)
+        : n(in_n), denominator(in_denominator)
+    {
+        numerators.swap(in_numerators);
+    };
+    int getDimension()const
+    {
+        return n;
+    };
+    const bigInteger& getDenominator()const
+    {
+        return denominator;
+    };
+    const bigInteger& getNumerator(int row, int column)const
+    {
+        if (row < 0 || row >= n || column < 0 || column >= n)
+            throw matrixException(BOUNDS_ERROR);
+        return numerators[static_cast<size_t>(row)*n + column];
+    };
+private:
+    int n;
+    bigInteger denominator;
+    std::vector<bigInteger> numerators;
+};
+
+//The denominator as "1/d *" on its own line, then the numerators laid out as operator<< lays out a matrix
+inline std::ostream& operator<<(std::ostream &out, const exactInverse &a)
+{
+    out << "1/" << a.getDenominator() << " *\n";
+    for (int y = 0; y < a.getDimension(); y++)
+    {
+        for (int x = 0; x < a.getDimension(); x++)
+        {
+            out << a.getNumerator(y, x) << '\t';
+        }
+        out << '\n';
+    }
+    return out;
+}
+
+/*
+Invert an integer matrix exactly. A^-1 = adj(A) / det(A), and both the adjugate and the
+determinant are integers, so they are found modulo enough word sized primes and put back
+together by the Chinese remainder theorem, then reduced by their greatest common divisor.
+Hadamard's bound, the product of the row (or column) lengths, bounds the determinant and every
+entry of the adjugate, so it fixes how many primes are needed before any is tried.
+Each prime is an independent Gauss-Jordan elimination, and they are run a batch at a time across
+the thread pool. A prime that divides det(A) is skipped. Once more primes have failed than could
+divide a determinant within the bound, the matrix is known to be singular.
+The residues are combined by Garner's algorithm into mixed radix digits,
+x = v0 + v1 p0 + v2 p0 p1 + ..., where each new digit only needs word sized arithmetic across all
+the entries at once, and each entry becomes a bigInteger just once, at the end.
+If the matrix is not square, dimension error is thrown.
+If the matrix is singular, math error is thrown.
+*/
+template <class Type>
+exactInverse invertExact(const matrix<Type> &a)
+{
+    static_assert(std::is_integral<Type>::value, "exact inversion needs an integer matrix");
+    if (a.getWidth() != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    const int n = a.getWidth();
+    const size_t elements = static_cast<size_t>(n) * n;
+    std::vector<long long> values(elements);
+    std::vector<double> columnSquares(n, 0.0);
+    double rowBits = 0;
+    for (int y = 0; y < n; y++)
+    {
+        double squares = 0;
+        for (int x = 0; x < n; x++)
+        {
+            values[static_cast<size_t>(y)*n + x] = static_cast<long long>(a(y, x));
+            const double v = static_cast<double>(a(y, x));
+            squares += v * v;
+            columnSquares[x] += v * v;
+        }
+        if (squares == 0.0)
+            throw matrixException(MATH_ERROR);
+        rowBits += 0.5 * std::log2(squares);
+    }
+    double columnBits = 0;
+    for (int x = 0; x < n; x++)
+    {
+        if (columnSquares[x] == 0.0)
+            throw matrixException(MATH_ERROR);
+        columnBits += 0.5 * std::log2(columnSquares[x]);
+    }
+    //One bit for the sign and one for rounding in the logs
+    const double bits = std::min(rowBits, columnBits) + 2.0;
+    const int maxFailures = static_cast<int>(bits / 25.0);
+
+    const int slots = threadPool::instance().size();
+    //The adjugate in row major order, then the determinant
+    const int count = static_cast<int>(elements) + 1;
+    std::vector<double> work(static_cast<size_t>(count) * slots);
+    std::vector<unsigned int> primes(slots);
+    std::vector<char> regular(slots);
+    std::vector<unsigned int> used;
+    std::vector<std::vector<unsigned int> > digits;
+    double covered = 0;
+    int failures = 0;
+    unsigned int prime = modular::primeLimit;
+    const int grain = 1024;
+    while (covered < bits)
+    {
+        for (int s = 0; s < slots; s++)
+        {
+            prime = modular::previousPrime(prime);
+            primes[s] = prime;
+        }
+        threadPool::instance().parallelFor(0, slots, 1, [&](int first, int last)
+        {
+            for (int s = first; s < last; s++)
+            {
+                const unsigned int p = primes[s];
+                double* block = work.data() + static_cast<size_t>(count) * s;
+                for (size_t i = 0; i < elements; i++)
+                {
+                    long long r = values[i] % static_cast<long long>(p);
+                    block[i] = static_cast<double>((r < 0) ? r + p : r);
+                }
+                unsigned int det;
+                regular[s] = modular::invert(block, n, p, det);
+                //adj(A) = det(A) A^-1
+                if (regular[s])
+                {
+                    modular::scale(block, det, p, 1.0 / p, static_cast<int>(elements));
+                    block[elements] = det;
+                }
+            }
+        });
+        for (int s = 0; s < slots && covered < bits; s++)
+        {
+            if (!regular[s])
+            {
+                if (++failures > maxFailures)
+                    throw matrixException(MATH_ERROR);
+                continue;
+            }
+            const unsigned int p = primes[s];
+            const double pinv = 1.0 / p;
+            double* block = work.data() + static_cast<size_t>(count) * s;
+            //c = (p0 p1 ... pk-1)^-1 mod p
+            unsigned long long product = 1;
+            for (size_t j = 0; j < used.size(); j++)
+            {
+                product = product * used[j] % p;
+            }
+            const double c = modular::inverse(static_cast<unsigned int>(product), p);
+            const size_t k = used.size();
+            digits.push_back(std::vector<unsigned int>(count));
+            threadPool::instance().parallelFor(0, count, grain, [&](int first, int last)
+            {
+                const int length = last - first;
+                //y = (v0 + v1 p0 + ... + vk-1 p0...pk-2) mod p, by Horner from the top digit
+                std::vector<double> y(length, 0.0);
+                for (size_t j = k; j-- > 0;)
+                {
+                    modular::multiplyAdd(y.data(), used[j], digits[j].data() + first, p, pinv, length);
+                }
+                //vk = (r - y) c mod p
+                for (int i = 0; i < length; i++)
+                {
+                    y[i] = block[first + i] - y[i];
+                }
+                modular::scale(y.data(), c, p, pinv, length);
+                for (int i = 0; i < length; i++)
+                {
+                    digits[k][first + i] = static_cast<unsigned int>(y[i]);
+                }
+            });
+            used.push_back(p);
+            covered += std::log2(static_cast<double>(p));
+        }
+    }
+
+    bigInteger modulus(1);
+    for (size_t j = used.size(); j-- > 0;)
+    {
+        modulus.multiplyAdd(used[j], 0);
+    }
+    //Out of mixed radix, and back to the symmetric range so negative entries come out negative
+    std::vector<bigInteger> images(count);
+    threadPool::instance().parallelFor(0, count, grain / 4, [&](int first, int last)
+    {
+        for (int i = first; i < last; i++)
+        {
+            bigInteger x(static_cast<long long>(digits.back()[i]));
+            for (size_t j = used.size() - 1; j-- > 0;)
+            {
+                x.multiplyAdd(used[j], digits[j][i]);
+            }
+            if (modulus < x + x)
+                x -= modulus;
+            images[i].swap(x);
+        }
+    });
+    digits.clear();
+    bigInteger denominator = images.back();
+    images.pop_back();
+    if (denominator.isNegative())
+    {
+        denominator = -denominator;
+        for (size_t i = 0; i < elements; i++)
+        {
+            images[i] = -images[i];
+        }
+    }
+    //The divisor shrinks to 1 within a few entries for most matrices, ending the scan
+    bigInteger divisor = denominator;
+    const bigInteger one(1);
+    for (size_t i = 0; i < elements && divisor != one; i++)
+    {
+        if (!images[i].isZero())
+            divisor = gcd(divisor, images[i]);
+    }
+    if (divisor != one)
+    {
+        denominator = denominator / divisor;
+        threadPool::instance().parallelFor(0, static_cast<int>(elements), grain, [&](int first, int last)
+        {
+            for (int i = first; i < last; i++)
+            {
+                images[i] = images[i] / divisor;
+            }
+        });
+    }
+    return exactInverse(n, denominator, images);
+}
+
+}
+
+#endif
@@ -0,0 +1,251 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_HALF_H
+#define MATRIX_HALF_H
+
+#include <cstring>
+#include "matrixSimd.h"
+
+namespace Matrix
+{
+
+/*
+16 bit floating point storage types. half is IEEE binary16 (11 bits of precision, range about
+6e-5 to 65504) and bfloat16 keeps float's 8 bit exponent with 8 bits of precision. Both exist
+only to be stored: every operation converts to float, computes, and rounds the result back to
+nearest even, so a matrix<half> costs half the memory and bandwidth of a matrix<float>.
+*/
+namespace f16
+{
+
+inline unsigned int floatBits(float f)
+{
+    unsigned int bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+inline float bitsFloat(unsigned int bits)
+{
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline unsigned short fromFloat(float f)
+{
+#if defined(__F16C__)
+    return static_cast<unsigned short>(_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT));
+#else
+    //Overflow goes to infinity, and subnormals are rounded by letting the FPU add a magic number
+    const unsigned int infinity = 255u << 23;
+    const unsigned int tooBig = (127u + 16) << 23;
+    const unsigned int denormalMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+    unsigned int bits = floatBits(f);
+    unsigned int sign = bits & 0x80000000u;
+    bits ^= sign;
+    unsigned int output;
+    if (bits >= tooBig)
+    {
+        output = (bits > infinity) ? 0x7e00 : 0x7c00;
+    }
+    else if (bits < (113u << 23))
+    {
+        output = floatBits(bitsFloat(bits) + bitsFloat(denormalMagic)) - denormalMagic;
+    }
+    else
+    {
+        unsigned int odd = (bits >> 13) & 1;
+        bits += (static_cast<unsigned int>(15 - 127) << 23) + 0xfff + odd;
+        output = bits >> 13;
+    }
+    return static_cast<unsigned short>(output | (sign >> 16));
+#endif
+}
+
+inline float toFloat(unsigned short h)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    const unsigned int shiftedExponent = 0x7c00u << 13;
+    unsigned int bits = (h & 0x7fffu) << 13;
+    unsigned int exponent = bits & shiftedExponent;
+    bits += (127u - 15) << 23;
+    if (exponent == shiftedExponent)
+    {
+        bits += (128u - 16) << 23;
+    }
+    else if (exponent == 0)
+    {
+        bits += 1u << 23;
+        bits = floatBits(bitsFloat(bits) - bitsFloat(113u << 23));
+    }
+    return bitsFloat(bits | ((h & 0x8000u) << 16));
+#endif
+}
+
+//bfloat16 is the top half of a float, rounded to nearest even, with NaN kept quiet
+inline unsigned short bfloatFromFloat(float f)
+{
+    unsigned int bits = floatBits(f);
+    if ((bits & 0x7fffffffu) > 0x7f800000u)
+        return static_cast<unsigned short>((bits >> 16) | 0x40);
+    bits += 0x7fffu + ((bits >> 16) & 1);
+    return static_cast<unsigned short>(bits >> 16);
+}
+
+inline float bfloatToFloat(unsigned short b)
+{
+    return bitsFloat(static_cast<unsigned int>(b) << 16);
+}
+
+}
+
+/*
+The two types share their shape, only the conversions differ. The default constructor is left
+trivial so that matrices of them can use the same uninitialised storage as the built in types.
+*/
+struct half
+{
+    unsigned short bits;
+    half() = default;
+    half(float value) : bits(f16::fromFloat(value)) {};
+    operator float()const
+    {
+        return f16::toFloat(bits);
+    };
+    half& operator+=(float x)
+    {
+        return *this = half(static_cast<float>(*this) + x);
+    };
+    half& operator-=(float x)
+    {
+        return *this = half(static_cast<float>(*this) - x);
+    };
+    half& operator*=(float x)
+    {
+        return *this = half(static_cast<float>(*this) * x);
+    };
+    half& operator/=(float x)
+    {
+        return *this = half(static_cast<float>(*this) / x);
+    };
+};
+
+struct bfloat16
+{
+    unsigned short bits;
+    bfloat16() = default;
+    bfloat16(float value) : bits(f16::bfloatFromFloat(value)) {};
+    operator float()const
+    {
+        return f16::bfloatToFloat(bits);
+    };
+    bfloat16& operator+=(float x)
+    {
+        return *this = bfloat16(static_cast<float>(*this) + x);
+    };
+    bfloat16& operator-=(float x)
+    {
+        return *this = bfloat16(static_cast<float>(*this) - x);
+    };
+    bfloat16& operator*=(float x)
+    {
+        return *this = bfloat16(static_cast<float>(*this) * x);
+    };
+    bfloat16& operator/=(float x)
+    {
+        return *this = bfloat16(static_cast<float>(*this) / x);
+    };
+};
+
+namespace simd
+{
+
+template <>
+struct accumulator<half>
+{
+    typedef float type;
+};
+
+template <>
+struct accumulator<bfloat16>
+{
+    typedef float type;
+};
+
+#if defined(__F16C__)
+
+template <>
+inline void convert<half, float>(const half* in, float* out, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+
+template <>
+inline void convert<float, half>(const float* in, half* out, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+template <>
+inline void convert<bfloat16, float>(const bfloat16* in, float* out, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+    }
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+
+//Same rounding as bfloatFromFloat, eight at a time
+template <>
+inline void convert<float, bfloat16>(const float* in, bfloat16* out, int n)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i quiet = _mm256_set1_epi32(0x400000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(in + i);
+        __m256i bits = _mm256_castps_si256(v);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+        __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(bias, odd));
+        __m256 nan = _mm256_cmp_ps(v, v, _CMP_UNORD_Q);
+        rounded = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(rounded),
+                                      _mm256_castsi256_ps(_mm256_or_si256(bits, quiet)), nan));
+        __m256i top = _mm256_srli_epi32(rounded, 16);
+        //packus works within 128 bit lanes, the permute puts the two halves back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(top, top), 0xd8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(packed));
+    }
+    for (; i < n; i++)
+        out[i] = in[i];
+}
+
+#endif
+
+}
+
+}
+
+#endif
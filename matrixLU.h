@@ -0,0 +1,252 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_LU_H
+#define MATRIX_LU_H
+
+#include <vector>
+#include <cmath>
+#include "matrix.h"
+
+namespace Matrix
+{
+
+/*
+LU decomposition with partial pivoting, PA = LU, held in double precision.
+Factoring costs O(n^3) once, after which every solve against the same matrix is O(n^2) per
+right hand side, so a factorization is worth keeping when one matrix is used repeatedly.
+If the matrix is not square, dimension error is thrown.
+If the matrix is singular, math error is thrown.
+*/
+class luDecomposition
+{
+public:
+    template <class Type>
+    explicit luDecomposition(const matrix<Type> &a);
+    int getDimension()const
+    {
+        return n;
+    };
+    double determinant()const;
+    matrix<double> solve(const matrix<double> &b)const;
+    matrix<double> inverse()const;
+private:
+    void factor();
+    void substitute(double* b, int stride, int first, int last)const;
+    int n;
+    int sign;
+    matrix<double> lu;
+    std::vector<int> pivot;
+};
+
+template <class Type>
+luDecomposition::luDecomposition(const matrix<Type> &a)
+    : n(a.getWidth()), sign(1), lu(static_cast<matrix<double> >(a)), pivot(a.getWidth())
+{
+    if (a.getWidth() != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    factor();
+}
+
+/*
+Right looking elimination. The pivot row is chosen by the largest magnitude in the column and
+swapped into place, then the rows below are updated in parallel once the trailing block is big
+enough to be worth it.
+A triangular matrix, or one zero outside a band narrow next to n, is factored inside its band
+instead, which for a triangular matrix is O(n^2) or less.
+*/
+inline void luDecomposition::factor()
+{
+    double* data = lu.getData();
+    const int stride = lu.getStride();
+    const structure::shape s = structure::detect(data, stride, n);
+    if (s.upper() || s.lower() || s.banded())
+    {
+        structure::bandFactor(data, stride, n, s.lowerBandwidth, s.upperBandwidth, !s.lower(), pivot.data(), sign);
+        return;
+    }
+    if (blas::routines<double>::factor(data, stride, n, pivot.data(), sign))
+        return;
+    for (int k = 0; k < n; k++)
+    {
+        checkpoint();
+        int p = k;
+        double best = std::fabs(data[k*stride + k]);
+        for (int i = k + 1; i < n; i++)
+        {
+            double v = std::fabs(data[i*stride + k]);
+            if (v > best)
+            {
+                best = v;
+                p = i;
+            }
+        }
+        if (best == 0.0)
+            throw matrixException(MATH_ERROR);
+        pivot[k] = p;
+        if (p != k)
+        {
+            sign = -sign;
+            double* rowK = data + k*stride;
+            double* rowP = data + p*stride;
+            for (int x = 0; x < n; x++)
+            {
+                double tmp = rowK[x];
+                rowK[x] = rowP[x];
+                rowP[x] = tmp;
+            }
+        }
+        const double* rowK = data + k*stride;
+        const double inv = 1.0 / rowK[k];
+        const int remaining = n - k - 1;
+        const int grain = 1 + 32768 / (remaining + 1);
+        threadPool::instance().parallelFor(k + 1, n, grain, [=](int first, int last)
+        {
+            for (int i = first; i < last; i++)
+            {
+                double* rowI = data + i*stride;
+                double l = rowI[k] * inv;
+                rowI[k] = l;
+                if (l == 0.0)
+                    continue;
+                for (int x = k + 1; x < n; x++)
+                {
+                    rowI[x] -= l * rowK[x];
+                }
+            }
+        });
+        reportProgress(static_cast<long long>(remaining) * remaining);
+    }
+}
+
+/*
+Determinant of a square matrix as the product of its LU pivots, 0 if the factorization finds it
+singular. This is what determinant uses above its cofactor limit.
+*/
+template <class Type>
+double factoredDeterminant(const matrix<Type> &a)
+{
+    try
+    {
+        return luDecomposition(a).determinant();
+    }
+    catch (const matrixException &e)
+    {
+        if (e.getErrorCode() != MATH_ERROR)
+            throw;
+        return 0.0;
+    }
+}
+
+//The determinant is the product of the diagonal of U, negated for each row swap
+inline double luDecomposition::determinant()const
+{
+    double output = sign;
+    for (int i = 0; i < n; i++)
+    {
+        output *= lu(i, i);
+    }
+    return output;
+}
+
+/*
+Forward and back substitution for columns [first, last) of a row major block of right hand
+sides, in place. Each step is a row operation across the block so the inner loop is contiguous.
+*/
+inline void luDecomposition::substitute(double* b, int stride, int first, int last)const
+{
+    const double* data = lu.getData();
+    const int luStride = lu.getStride();
+    for (int k = 0; k < n; k++)
+    {
+        if (pivot[k] != k)
+        {
+            double* rowK = b + k*stride;
+            double* rowP = b + pivot[k]*stride;
+            for (int x = first; x < last; x++)
+            {
+                double tmp = rowK[x];
+                rowK[x] = rowP[x];
+                rowP[x] = tmp;
+            }
+        }
+    }
+    for (int i = 1; i < n; i++)
+    {
+        const double* l = data + i*luStride;
+        double* rowI = b + i*stride;
+        for (int j = 0; j < i; j++)
+        {
+            const double f = l[j];
+            if (f == 0.0)
+                continue;
+            const double* rowJ = b + j*stride;
+            for (int x = first; x < last; x++)
+            {
+                rowI[x] -= f * rowJ[x];
+            }
+        }
+    }
+    for (int i = n - 1; i >= 0; i--)
+    {
+        const double* u = data + i*luStride;
+        double* rowI = b + i*stride;
+        for (int j = i + 1; j < n; j++)
+        {
+            const double f = u[j];
+            if (f == 0.0)
+                continue;
+            const double* rowJ = b + j*stride;
+            for (int x = first; x < last; x++)
+            {
+                rowI[x] -= f * rowJ[x];
+            }
+        }
+        const double inv = 1.0 / u[i];
+        for (int x = first; x < last; x++)
+        {
+            rowI[x] *= inv;
+        }
+    }
+}
+
+/*
+Solve AX = B for X, B has one right hand side per column.
+Blocks of columns are independent and are shared out over the thread pool.
+*/
+inline matrix<double> luDecomposition::solve(const matrix<double> &b)const
+{
+    if (b.getHeight() != n)
+        throw matrixException(DIMENSION_ERROR);
+    matrix<double> output(b);
+    double* data = output.getData();
+    const int stride = output.getStride();
+    const int columns = output.getWidth();
+    if (blas::routines<double>::solve(lu.getData(), lu.getStride(), pivot.data(), n, data, stride, columns))
+        return output;
+    const int columnBlock = 64;
+    const int grain = (static_cast<double>(n) * n * columns < 262144.0) ? columns : columnBlock;
+    threadPool::instance().parallelFor(0, columns, grain, [=](int first, int last)
+    {
+        substitute(data, stride, first, last);
+    });
+    return output;
+}
+
+inline matrix<double> luDecomposition::inverse()const
+{
+    matrix<double> identity(n, n);
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            identity(y, x) = (x == y) ? 1.0 : 0.0;
+        }
+    }
+    return solve(identity);
+}
+
+}
+
+#endif
@@ -0,0 +1,567 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_MPI_H
+#define MATRIX_MPI_H
+
+#include <vector>
+#include <cmath>
+#include <mpi.h>
+#include "matrix.h"
+
+namespace Matrix
+{
+
+/*
+distributedMatrix spreads a double precision matrix over the ranks of an MPI communicator in a
+2D block cyclic layout, the same layout ScaLAPACK uses. The ranks form a near square grid of
+gridRows x gridColumns processes and block (by, bx) of the matrix, block*block elements, lives
+on process (by mod gridRows, bx mod gridColumns). Every rank keeps its share of the blocks as one
+row major local array, so the matrix never has to fit on a single node.
+All member functions that communicate are collective and must be called on every rank.
+*/
+class distributedMatrix
+{
+public:
+    distributedMatrix(int in_width, int in_height, int in_block = 64, MPI_Comm in_comm = MPI_COMM_WORLD);
+    ~distributedMatrix();
+    int getWidth()const
+    {
+        return width;
+    };
+    int getHeight()const
+    {
+        return height;
+    };
+    int getBlockSize()const
+    {
+        return block;
+    };
+    int getLocalRows()const
+    {
+        return localRows;
+    };
+    int getLocalColumns()const
+    {
+        return localColumns;
+    };
+    double* getLocal()
+    {
+        return local.data();
+    };
+    //Map between global and local indices along rows and columns
+    int ownerRow(int y)const
+    {
+        return (y / block) % gridRows;
+    };
+    int ownerColumn(int x)const
+    {
+        return (x / block) % gridColumns;
+    };
+    int localRow(int y)const
+    {
+        return (y / (block * gridRows)) * block + y % block;
+    };
+    int localColumn(int x)const
+    {
+        return (x / (block * gridColumns)) * block + x % block;
+    };
+    int globalRow(int l)const
+    {
+        return ((l / block) * gridRows + myRow) * block + l % block;
+    };
+    int globalColumn(int l)const
+    {
+        return ((l / block) * gridColumns + myColumn) * block + l % block;
+    };
+    void scatter(const matrix<double> &a, int root = 0);
+    matrix<double> gather(int root = 0);
+    friend void factor(distributedMatrix &a, std::vector<int> &pivot);
+    friend void invert(distributedMatrix &a);
+    friend void multiply(distributedMatrix &a, distributedMatrix &b, distributedMatrix &c);
+private:
+    distributedMatrix(const distributedMatrix &);
+    distributedMatrix& operator=(const distributedMatrix &);
+    static int share(int n, int block, int index, int count);
+    void pack(const matrix<double> &a, int row, int column, std::vector<double> &buffer)const;
+    void findPivot(int k, double &value, int &row);
+    void swapRows(int r, int s);
+    void swapColumns(int r, int s);
+    int width;
+    int height;
+    int block;
+    int gridRows;
+    int gridColumns;
+    int myRow;
+    int myColumn;
+    int localRows;
+    int localColumns;
+    MPI_Comm comm;
+    MPI_Comm rowComm;
+    MPI_Comm columnComm;
+    std::vector<double> local;
+};
+
+//Number of rows (or columns) of an n long dimension that land on process index of count
+inline int distributedMatrix::share(int n, int block, int index, int count)
+{
+    int blocks = n / block;
+    int output = (blocks / count) * block;
+    int extra = blocks % count;
+    if (index < extra)
+        output += block;
+    else if (index == extra)
+        output += n % block;
+    return output;
+}
+
+inline distributedMatrix::distributedMatrix(int in_width, int in_height, int in_block, MPI_Comm in_comm)
+    : width(in_width), height(in_height), block(in_block), comm(in_comm)
+{
+    if (width <= 0 || height <= 0 || block <= 0)
+        throw matrixException(DIMENSION_ERROR);
+    int ranks, rank;
+    MPI_Comm_size(comm, &ranks);
+    MPI_Comm_rank(comm, &rank);
+    gridRows = 1;
+    for (int r = 1; r * r <= ranks; r++)
+    {
+        if (ranks % r == 0)
+            gridRows = r;
+    }
+    gridColumns = ranks / gridRows;
+    myRow = rank / gridColumns;
+    myColumn = rank % gridColumns;
+    //rowComm links the processes of one grid row, ranked by column, and columnComm the reverse
+    MPI_Comm_split(comm, myRow, myColumn, &rowComm);
+    MPI_Comm_split(comm, myColumn, myRow, &columnComm);
+    localRows = share(height, block, myRow, gridRows);
+    localColumns = share(width, block, myColumn, gridColumns);
+    local.assign(static_cast<size_t>(localRows) * localColumns, 0.0);
+}
+
+inline distributedMatrix::~distributedMatrix()
+{
+    MPI_Comm_free(&rowComm);
+    MPI_Comm_free(&columnComm);
+}
+
+//Collect the elements process (row, column) owns, in its local row major order
+inline void distributedMatrix::pack(const matrix<double> &a, int row, int column, std::vector<double> &buffer)const
+{
+    for (int by = row * block; by < height; by += block * gridRows)
+    {
+        for (int y = by; y < by + block && y < height; y++)
+        {
+            for (int bx = column * block; bx < width; bx += block * gridColumns)
+            {
+                for (int x = bx; x < bx + block && x < width; x++)
+                {
+                    buffer.push_back(a(y, x));
+                }
+            }
+        }
+    }
+}
+
+/*
+Distribute a matrix held on root to every rank. Only root's argument is read, the other ranks
+may pass an empty matrix.
+If root's matrix is not the distributed shape, dimension error is thrown on every rank, so none is
+left waiting in the scatter.
+*/
+inline void distributedMatrix::scatter(const matrix<double> &a, int root)
+{
+    int ranks, rank;
+    MPI_Comm_size(comm, &ranks);
+    MPI_Comm_rank(comm, &rank);
+    int shaped = (rank != root) || (a.getWidth() == width && a.getHeight() == height);
+    MPI_Bcast(&shaped, 1, MPI_INT, root, comm);
+    if (!shaped)
+        throw matrixException(DIMENSION_ERROR);
+    std::vector<double> buffer;
+    std::vector<int> counts(ranks), offsets(ranks);
+    if (rank == root)
+    {
+        buffer.reserve(static_cast<size_t>(width) * height);
+        for (int r = 0; r < ranks; r++)
+        {
+            offsets[r] = static_cast<int>(buffer.size());
+            pack(a, r / gridColumns, r % gridColumns, buffer);
+            counts[r] = static_cast<int>(buffer.size()) - offsets[r];
+        }
+    }
+    MPI_Scatterv(buffer.data(), counts.data(), offsets.data(), MPI_DOUBLE,
+                 local.data(), static_cast<int>(local.size()), MPI_DOUBLE, root, comm);
+}
+
+//Reassemble the whole matrix on root, the other ranks get an empty matrix back
+inline matrix<double> distributedMatrix::gather(int root)
+{
+    int ranks, rank;
+    MPI_Comm_size(comm, &ranks);
+    MPI_Comm_rank(comm, &rank);
+    std::vector<int> counts(ranks), offsets(ranks);
+    int mine = static_cast<int>(local.size());
+    MPI_Gather(&mine, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+    std::vector<double> buffer;
+    if (rank == root)
+    {
+        int total = 0;
+        for (int r = 0; r < ranks; r++)
+        {
+            offsets[r] = total;
+            total += counts[r];
+        }
+        buffer.resize(total);
+    }
+    MPI_Gatherv(local.data(), mine, MPI_DOUBLE, buffer.data(), counts.data(), offsets.data(), MPI_DOUBLE, root, comm);
+    if (rank != root)
+        return matrix<double>();
+    matrix<double> output(width, height);
+    for (int r = 0; r < ranks; r++)
+    {
+        const double* src = buffer.data() + offsets[r];
+        int row = r / gridColumns, column = r % gridColumns;
+        for (int by = row * block; by < height; by += block * gridRows)
+        {
+            for (int y = by; y < by + block && y < height; y++)
+            {
+                for (int bx = column * block; bx < width; bx += block * gridColumns)
+                {
+                    for (int x = bx; x < bx + block && x < width; x++)
+                    {
+                        output(y, x) = *src++;
+                    }
+                }
+            }
+        }
+    }
+    return output;
+}
+
+/*
+Partial pivoting for column k: the largest magnitude at or below the diagonal. The owning process
+column reduces over its ranks, the winner supplies the signed value, and the result is shared
+along every grid row so all ranks agree on value and row.
+*/
+inline void distributedMatrix::findPivot(int k, double &value, int &row)
+{
+    const int column = ownerColumn(k);
+    struct
+    {
+        double magnitude;
+        int row;
+    } best, winner;
+    double pair[2] = {0.0, -1.0};
+    if (myColumn == column)
+    {
+        const int lx = localColumn(k);
+        best.magnitude = -1.0;
+        best.row = -1;
+        for (int ly = 0; ly < localRows; ly++)
+        {
+            int y = globalRow(ly);
+            double v = std::fabs(local[static_cast<size_t>(ly) * localColumns + lx]);
+            if (y >= k && v > best.magnitude)
+            {
+                best.magnitude = v;
+                best.row = y;
+            }
+        }
+        MPI_Allreduce(&best, &winner, 1, MPI_DOUBLE_INT, MPI_MAXLOC, columnComm);
+        //MAXLOC reduces on the value, ties and the row travel with it
+        double signedValue = 0.0;
+        if (winner.row >= 0 && ownerRow(winner.row) == myRow)
+            signedValue = local[static_cast<size_t>(localRow(winner.row)) * localColumns + lx];
+        if (winner.row >= 0)
+            MPI_Bcast(&signedValue, 1, MPI_DOUBLE, ownerRow(winner.row), columnComm);
+        pair[0] = signedValue;
+        pair[1] = winner.row;
+    }
+    MPI_Bcast(pair, 2, MPI_DOUBLE, column, rowComm);
+    value = pair[0];
+    row = static_cast<int>(pair[1]);
+}
+
+//Swap global rows r and s across every column, exchanging between grid rows when needed
+inline void distributedMatrix::swapRows(int r, int s)
+{
+    if (r == s)
+        return;
+    const int ownerR = ownerRow(r), ownerS = ownerRow(s);
+    if (ownerR == myRow && ownerS == myRow)
+    {
+        double* a = local.data() + static_cast<size_t>(localRow(r)) * localColumns;
+        double* b = local.data() + static_cast<size_t>(localRow(s)) * localColumns;
+        for (int x = 0; x < localColumns; x++)
+        {
+            double tmp = a[x];
+            a[x] = b[x];
+            b[x] = tmp;
+        }
+    }
+    else if (ownerR == myRow || ownerS == myRow)
+    {
+        int mine = (ownerR == myRow) ? r : s;
+        int partner = (ownerR == myRow) ? ownerS : ownerR;
+        double* a = local.data() + static_cast<size_t>(localRow(mine)) * localColumns;
+        MPI_Sendrecv_replace(a, localColumns, MPI_DOUBLE, partner, 0, partner, 0, columnComm, MPI_STATUS_IGNORE);
+    }
+}
+
+//Swap global columns r and s across every row
+inline void distributedMatrix::swapColumns(int r, int s)
+{
+    if (r == s)
+        return;
+    const int ownerR = ownerColumn(r), ownerS = ownerColumn(s);
+    if (ownerR != myColumn && ownerS != myColumn)
+        return;
+    if (ownerR == myColumn && ownerS == myColumn)
+    {
+        int a = localColumn(r), b = localColumn(s);
+        for (int ly = 0; ly < localRows; ly++)
+        {
+            double* row = local.data() + static_cast<size_t>(ly) * localColumns;
+            double tmp = row[a];
+            row[a] = row[b];
+            row[b] = tmp;
+        }
+        return;
+    }
+    int mine = (ownerR == myColumn) ? r : s;
+    int partner = (ownerR == myColumn) ? ownerS : ownerR;
+    int lx = localColumn(mine);
+    std::vector<double> buffer(localRows);
+    for (int ly = 0; ly < localRows; ly++)
+    {
+        buffer[ly] = local[static_cast<size_t>(ly) * localColumns + lx];
+    }
+    MPI_Sendrecv_replace(buffer.data(), localRows, MPI_DOUBLE, partner, 0, partner, 0, rowComm, MPI_STATUS_IGNORE);
+    for (int ly = 0; ly < localRows; ly++)
+    {
+        local[static_cast<size_t>(ly) * localColumns + lx] = buffer[ly];
+    }
+}
+
+/*
+Distributed LU with partial pivoting, PA = LU in place, L unit lower below the diagonal and U
+on and above it. pivot[k] is the row swapped with row k at step k, and is the same on all ranks.
+At each step the pivot row is broadcast down the process columns and the column of multipliers
+along the process rows, then every rank updates the part of the trailing matrix it owns.
+If the matrix is not square, dimension error is thrown.
+If the matrix is singular, math error is thrown on every rank.
+*/
+inline void factor(distributedMatrix &a, std::vector<int> &pivot)
+{
+    if (a.width != a.height)
+        throw matrixException(DIMENSION_ERROR);
+    const int n = a.width;
+    const int columns = a.localColumns;
+    pivot.resize(n);
+    std::vector<double> pivotRow(columns), multipliers(a.localRows);
+    for (int k = 0; k < n; k++)
+    {
+        double value;
+        int row;
+        a.findPivot(k, value, row);
+        if (value == 0.0)
+            throw matrixException(MATH_ERROR);
+        pivot[k] = row;
+        a.swapRows(k, row);
+        const int rowOwner = a.ownerRow(k);
+        const int columnOwner = a.ownerColumn(k);
+        if (a.myRow == rowOwner)
+        {
+            const double* src = a.local.data() + static_cast<size_t>(a.localRow(k)) * columns;
+            pivotRow.assign(src, src + columns);
+        }
+        MPI_Bcast(pivotRow.data(), columns, MPI_DOUBLE, rowOwner, a.columnComm);
+        //First local row and column past k
+        int ly0 = 0, lx0 = 0;
+        while (ly0 < a.localRows && a.globalRow(ly0) <= k)
+            ly0++;
+        while (lx0 < columns && a.globalColumn(lx0) <= k)
+            lx0++;
+        if (a.myColumn == columnOwner)
+        {
+            const int lx = a.localColumn(k);
+            const double inv = 1.0 / value;
+            for (int ly = ly0; ly < a.localRows; ly++)
+            {
+                double &l = a.local[static_cast<size_t>(ly) * columns + lx];
+                l *= inv;
+                multipliers[ly] = l;
+            }
+        }
+        MPI_Bcast(multipliers.data() + ly0, a.localRows - ly0, MPI_DOUBLE, columnOwner, a.rowComm);
+        double* data = a.local.data();
+        const double* u = pivotRow.data();
+        const double* l = multipliers.data();
+        threadPool::instance().parallelFor(ly0, a.localRows, 16, [=](int first, int last)
+        {
+            for (int ly = first; ly < last; ly++)
+            {
+                double* dst = data + static_cast<size_t>(ly) * columns;
+                const double f = l[ly];
+                for (int lx = lx0; lx < columns; lx++)
+                {
+                    dst[lx] -= f * u[lx];
+                }
+            }
+        });
+    }
+}
+
+/*
+Distributed in place inversion by Gauss-Jordan elimination with partial pivoting.
+Each step broadcasts the pivot row down the process columns and the pivot column along the
+process rows, after which every element is updated locally. The row swaps become column swaps
+of the inverse, which are undone in reverse order at the end.
+If the matrix is not square, dimension error is thrown.
+If the matrix is singular, math error is thrown on every rank.
+*/
+inline void invert(distributedMatrix &a)
+{
+    if (a.width != a.height)
+        throw matrixException(DIMENSION_ERROR);
+    const int n = a.width;
+    const int columns = a.localColumns;
+    std::vector<int> pivot(n);
+    std::vector<double> pivotRow(columns), pivotColumn(a.localRows);
+    for (int k = 0; k < n; k++)
+    {
+        double value;
+        int row;
+        a.findPivot(k, value, row);
+        if (value == 0.0)
+            throw matrixException(MATH_ERROR);
+        pivot[k] = row;
+        a.swapRows(k, row);
+        const int rowOwner = a.ownerRow(k);
+        const int columnOwner = a.ownerColumn(k);
+        if (a.myRow == rowOwner)
+        {
+            const double* src = a.local.data() + static_cast<size_t>(a.localRow(k)) * columns;
+            pivotRow.assign(src, src + columns);
+        }
+        MPI_Bcast(pivotRow.data(), columns, MPI_DOUBLE, rowOwner, a.columnComm);
+        if (a.myColumn == columnOwner)
+        {
+            const int lx = a.localColumn(k);
+            for (int ly = 0; ly < a.localRows; ly++)
+            {
+                pivotColumn[ly] = a.local[static_cast<size_t>(ly) * columns + lx];
+            }
+        }
+        MPI_Bcast(pivotColumn.data(), a.localRows, MPI_DOUBLE, columnOwner, a.rowComm);
+        const double inv = 1.0 / value;
+        const int kRow = (a.myRow == rowOwner) ? a.localRow(k) : -1;
+        const int kColumn = (a.myColumn == columnOwner) ? a.localColumn(k) : -1;
+        double* data = a.local.data();
+        const double* u = pivotRow.data();
+        const double* c = pivotColumn.data();
+        threadPool::instance().parallelFor(0, a.localRows, 16, [=](int first, int last)
+        {
+            for (int ly = first; ly < last; ly++)
+            {
+                double* dst = data + static_cast<size_t>(ly) * columns;
+                if (ly == kRow)
+                {
+                    for (int lx = 0; lx < columns; lx++)
+                    {
+                        dst[lx] = (lx == kColumn) ? inv : u[lx] * inv;
+                    }
+                    continue;
+                }
+                const double f = c[ly] * inv;
+                for (int lx = 0; lx < columns; lx++)
+                {
+                    dst[lx] = (lx == kColumn) ? -f : dst[lx] - f * u[lx];
+                }
+            }
+        });
+    }
+    for (int k = n - 1; k >= 0; k--)
+    {
+        a.swapColumns(k, pivot[k]);
+    }
+}
+
+/*
+Distributed product c = a*b by SUMMA. For each block of the inner dimension the owning process
+column broadcasts its panel of a along the process rows, the owning process row broadcasts its
+panel of b down the process columns, and every rank adds the product of the two panels to its
+part of c. All three matrices must share a block size and communicator.
+*/
+inline void multiply(distributedMatrix &a, distributedMatrix &b, distributedMatrix &c)
+{
+    if (a.width != b.height || c.height != a.height || c.width != b.width)
+        throw matrixException(DIMENSION_ERROR);
+    if (a.block != b.block || a.block != c.block)
+        throw matrixException(DIMENSION_ERROR);
+    const int nb = a.block;
+    const int rows = c.localRows, columns = c.localColumns;
+    std::vector<double> aPanel, bPanel;
+    for (size_t e = 0; e < c.local.size(); e++)
+    {
+        c.local[e] = 0.0;
+    }
+    for (int k0 = 0; k0 < a.width; k0 += nb)
+    {
+        const int depth = (k0 + nb < a.width) ? nb : a.width - k0;
+        const int aOwner = a.ownerColumn(k0);
+        const int bOwner = b.ownerRow(k0);
+        aPanel.resize(static_cast<size_t>(a.localRows) * depth);
+        bPanel.resize(static_cast<size_t>(depth) * b.localColumns);
+        if (a.myColumn == aOwner)
+        {
+            const int lx = a.localColumn(k0);
+            for (int ly = 0; ly < a.localRows; ly++)
+            {
+                for (int d = 0; d < depth; d++)
+                {
+                    aPanel[static_cast<size_t>(ly) * depth + d] = a.local[static_cast<size_t>(ly) * a.localColumns + lx + d];
+                }
+            }
+        }
+        if (b.myRow == bOwner)
+        {
+            const int ly = b.localRow(k0);
+            for (int d = 0; d < depth; d++)
+            {
+                for (int lx = 0; lx < b.localColumns; lx++)
+                {
+                    bPanel[static_cast<size_t>(d) * b.localColumns + lx] = b.local[static_cast<size_t>(ly + d) * b.localColumns + lx];
+                }
+            }
+        }
+        MPI_Bcast(aPanel.data(), static_cast<int>(aPanel.size()), MPI_DOUBLE, aOwner, a.rowComm);
+        MPI_Bcast(bPanel.data(), static_cast<int>(bPanel.size()), MPI_DOUBLE, bOwner, b.columnComm);
+        double* dst = c.local.data();
+        const double* ap = aPanel.data();
+        const double* bp = bPanel.data();
+        threadPool::instance().parallelFor(0, rows, 16, [=](int first, int last)
+        {
+            for (int ly = first; ly < last; ly++)
+            {
+                double* cRow = dst + static_cast<size_t>(ly) * columns;
+                for (int d = 0; d < depth; d++)
+                {
+                    const double f = ap[static_cast<size_t>(ly) * depth + d];
+                    const double* bRow = bp + static_cast<size_t>(d) * columns;
+                    for (int lx = 0; lx < columns; lx++)
+                    {
+                        cRow[lx] += f * bRow[lx];
+                    }
+                }
+            }
+        });
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,285 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_MEMORY_H
+#define MATRIX_MEMORY_H
+
+#include <new>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "matrixError.h"
+#include "matrixThreads.h"
+
+namespace Matrix
+{
+
+//Where the pages of a large allocation are placed across NUMA nodes
+enum placementPolicy
+{
+    PLACE_DEFAULT = 0,  //Left to the kernel, normally the node of the thread that allocates
+    PLACE_FIRST_TOUCH,  //Pages are first written by the whole thread pool, spreading them over its nodes
+    PLACE_INTERLEAVE,   //Pages are dealt out to every node in turn
+    PLACE_BIND          //Pages are bound to one node, or tile by tile to every node in turn
+};
+
+//Page size used for large allocations
+enum pagePolicy
+{
+    PAGES_DEFAULT = 0,
+    PAGES_TRANSPARENT,  //2MB aligned and advised for transparent huge pages
+    PAGES_HUGETLB       //Explicit huge pages from the reserved pool, falling back to transparent ones
+};
+
+/*
+allocationPolicy decides how matrix storage is allocated. Allocations smaller than threshold
+bytes always come from the heap, larger ones are mapped directly so they can be placed and
+given huge pages. With PLACE_BIND, node picks the node to bind to, or -1 binds each tileBytes
+piece to the next node in turn.
+*/
+struct allocationPolicy
+{
+    placementPolicy placement;
+    pagePolicy pages;
+    int node;
+    size_t tileBytes;
+    size_t threshold;
+};
+
+/*
+The process wide policy, read once from the environment and free to be changed afterwards.
+MATRIX_NUMA is one of firsttouch, interleave, bind (tile by tile) or bind:N (to node N), and
+MATRIX_HUGEPAGES is thp or hugetlb. Changing it only affects later allocations.
+*/
+inline allocationPolicy& memoryPolicy()
+{
+    static allocationPolicy policy = []()
+    {
+        allocationPolicy p;
+        p.placement = PLACE_DEFAULT;
+        p.pages = PAGES_DEFAULT;
+        p.node = -1;
+        p.tileBytes = 2 << 20;
+        p.threshold = 1 << 20;
+        const char* numa = std::getenv("MATRIX_NUMA");
+        if (numa)
+        {
+            std::string mode(numa);
+            if (mode == "firsttouch")
+                p.placement = PLACE_FIRST_TOUCH;
+            else if (mode == "interleave")
+                p.placement = PLACE_INTERLEAVE;
+            else if (mode.compare(0, 4, "bind") == 0)
+            {
+                p.placement = PLACE_BIND;
+                if (mode.size() > 5 && mode[4] == ':')
+                    p.node = std::atoi(mode.c_str() + 5);
+            }
+        }
+        const char* pages = std::getenv("MATRIX_HUGEPAGES");
+        if (pages)
+        {
+            std::string mode(pages);
+            if (mode == "thp")
+                p.pages = PAGES_TRANSPARENT;
+            else if (mode == "hugetlb")
+                p.pages = PAGES_HUGETLB;
+        }
+        return p;
+    }();
+    return policy;
+}
+
+namespace memory
+{
+
+const size_t hugePage = 2 << 20;
+
+/*
+The data of every block is preceded by a header recording how it was obtained, so it can be
+released correctly even if the policy has changed since. Heap blocks are cache line aligned and the
+header fills the first line. Mapped data starts on a page (2MB with transparent huge pages) and
+the header sits at the end of a small page kept in front of it; explicit huge pages cannot have a
+small page in front, so there the data starts a cache line into the first huge page.
+*/
+struct header
+{
+    void* base;
+    size_t length;
+    bool mapped;
+};
+const size_t headerBytes = 64;
+const size_t cacheLine = 64;
+
+//Set the policy of [address, address+length) with mbind, failures leave the kernel default
+inline void bind(void* address, size_t length, int mode, int node)
+{
+    const int nodes = numaNodeCount();
+    unsigned long mask = 0;
+    if (node < 0)
+    {
+        for (int n = 0; n < nodes && n < 64; n++)
+            mask |= 1UL << n;
+    }
+    else if (node < 64)
+    {
+        mask = 1UL << node;
+    }
+    if (mask)
+        syscall(SYS_mbind, address, length, mode, &mask, 64UL, 0UL);
+}
+
+inline void place(char* address, size_t length, size_t pageSize)
+{
+    const allocationPolicy &policy = memoryPolicy();
+    if (policy.placement == PLACE_INTERLEAVE)
+    {
+        bind(address, length, MPOL_INTERLEAVE, -1);
+    }
+    else if (policy.placement == PLACE_BIND && policy.node >= 0)
+    {
+        bind(address, length, MPOL_BIND, policy.node);
+    }
+    else if (policy.placement == PLACE_BIND)
+    {
+        const size_t tile = ((policy.tileBytes + pageSize - 1) / pageSize) * pageSize;
+        const int nodes = numaNodeCount();
+        for (size_t offset = 0, t = 0; offset < length; offset += tile, t++)
+        {
+            size_t piece = (length - offset < tile) ? length - offset : tile;
+            bind(address + offset, piece, MPOL_BIND, static_cast<int>(t % nodes));
+        }
+    }
+    else if (policy.placement == PLACE_FIRST_TOUCH)
+    {
+        //Each page goes to the node of the pool thread that happens to write it first
+        const size_t pages = length / pageSize;
+        threadPool::instance().parallelFor(0, static_cast<int>(pages), 16, [=](int first, int last)
+        {
+            for (int p = first; p < last; p++)
+                address[static_cast<size_t>(p) * pageSize] = 0;
+        });
+    }
+}
+
+/*
+Map length bytes of data (a multiple of the page size) with room for the header in front, and
+return where the data starts. Transparent huge pages need a 2MB aligned range, so the mapping is
+made one huge page larger and trimmed to the aligned data and the small page before it.
+*/
+inline char* map(size_t length, pagePolicy pages, size_t &pageSize, void* &base, size_t &mapped)
+{
+    const int protection = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+    if (pages == PAGES_HUGETLB)
+    {
+        size_t huge = ((headerBytes + length + hugePage - 1) / hugePage) * hugePage;
+        void* p = mmap(nullptr, huge, protection, flags | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            pageSize = hugePage;
+            base = p;
+            mapped = huge;
+            return static_cast<char*>(p) + headerBytes;
+        }
+        pages = PAGES_TRANSPARENT;
+    }
+#endif
+    pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (pages == PAGES_DEFAULT)
+    {
+        void* p = mmap(nullptr, pageSize + length, protection, flags, -1, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        base = p;
+        mapped = pageSize + length;
+        return static_cast<char*>(p) + pageSize;
+    }
+    size_t padded = pageSize + length + hugePage;
+    void* p = mmap(nullptr, padded, protection, flags, -1, 0);
+    if (p == MAP_FAILED)
+        return nullptr;
+    uintptr_t start = reinterpret_cast<uintptr_t>(p);
+    uintptr_t aligned = (start + pageSize + hugePage - 1) & ~(static_cast<uintptr_t>(hugePage) - 1);
+    uintptr_t front = aligned - pageSize;
+    if (front > start)
+        munmap(p, front - start);
+    size_t tail = (start + padded) - (aligned + length);
+    if (tail)
+        munmap(reinterpret_cast<void*>(aligned + length), tail);
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(aligned), length, MADV_HUGEPAGE);
+#endif
+    base = reinterpret_cast<void*>(front);
+    mapped = pageSize + length;
+    return reinterpret_cast<char*>(aligned);
+}
+
+}
+
+/*
+allocate storage for count elements under the current memoryPolicy, the elements are not
+initialised. Only types without constructors or destructors may be stored this way.
+If the memory cannot be obtained, memory error is thrown.
+*/
+template <class Type>
+Type* allocate(size_t count)
+{
+    static_assert(std::is_trivial<Type>::value, "matrix storage must be a trivial type");
+    const allocationPolicy &policy = memoryPolicy();
+    const size_t bytes = memory::headerBytes + count * sizeof(Type);
+    char* data = nullptr;
+    memory::header h;
+    if (bytes < policy.threshold || (policy.placement == PLACE_DEFAULT && policy.pages == PAGES_DEFAULT))
+    {
+        void* block = nullptr;
+        if (posix_memalign(&block, memory::cacheLine, bytes) != 0)
+            throw matrixException(MEMORY_ERROR);
+        data = static_cast<char*>(block) + memory::headerBytes;
+        h.base = block;
+        h.length = bytes;
+        h.mapped = false;
+    }
+    else
+    {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t length = ((count * sizeof(Type) + page - 1) / page) * page;
+        size_t pageSize;
+        data = memory::map(length, policy.pages, pageSize, h.base, h.length);
+        if (!data)
+            throw matrixException(MEMORY_ERROR);
+        h.mapped = true;
+        //Placement works on whole pages, which for explicit huge pages start before the data
+        char* first = static_cast<char*>(h.base) + (data - static_cast<char*>(h.base)) / pageSize * pageSize;
+        memory::place(first, static_cast<char*>(h.base) + h.length - first, pageSize);
+    }
+    std::memcpy(data - memory::headerBytes, &h, sizeof(h));
+    return reinterpret_cast<Type*>(data);
+}
+
+//release storage from allocate, null is ignored
+template <class Type>
+void release(Type* data)
+{
+    if (!data)
+        return;
+    memory::header h;
+    std::memcpy(&h, reinterpret_cast<char*>(data) - memory::headerBytes, sizeof(h));
+    if (h.mapped)
+        munmap(h.base, h.length);
+    else
+        std::free(h.base);
+}
+
+}
+
+#endif
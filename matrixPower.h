@@ -0,0 +1,250 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_POWER_H
+#define MATRIX_POWER_H
+
+#include <cmath>
+#include "matrix.h"
+#include "matrixLU.h"
+
+namespace Matrix
+{
+
+//The n*n identity matrix
+template <class Type>
+matrix<Type> identity(int n)
+{
+    matrix<Type> output(n, n);
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            output(y, x) = static_cast<Type>((x == y) ? 1 : 0);
+        }
+    }
+    return output;
+}
+
+/*
+A^k by binary exponentiation, O(log k) products instead of k. Three buffers are reused for the
+whole computation: the running result, the repeatedly squared base, and a scratch product which
+is swapped with whichever of the two it replaces. A negative k raises the inverse of A, found by
+LU in double precision and converted back to Type.
+If the matrix is not square, dimension error is thrown.
+If k is negative and the matrix is singular, math error is thrown.
+*/
+template <class Type>
+matrix<Type> pow(const matrix<Type> &a, long long k)
+{
+    const int n = a.getWidth();
+    if (n != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    matrix<Type> base;
+    if (k < 0)
+    {
+        luDecomposition(a).inverse().convertInto(base);
+    }
+    else
+    {
+        base = a;
+    }
+    //Negating the most negative long long overflows, so the magnitude is taken unsigned
+    unsigned long long e = (k < 0) ? 0ULL - static_cast<unsigned long long>(k) : static_cast<unsigned long long>(k);
+    if (e == 0)
+        return identity<Type>(n);
+    matrix<Type> result, scratch;
+    bool started = false;
+    for (;;)
+    {
+        if (e & 1)
+        {
+            //The first factor is copied rather than multiplied into an identity
+            if (started)
+            {
+                multiplyInto(result, base, scratch);
+                result.swap(scratch);
+            }
+            else
+            {
+                result = base;
+                started = true;
+            }
+        }
+        e >>= 1;
+        if (!e)
+            break;
+        multiplyInto(base, base, scratch);
+        base.swap(scratch);
+    }
+    return result;
+}
+
+namespace pade
+{
+
+//Largest 1-norm for which the Pade approximant of each degree is accurate to double precision (Higham 2005)
+const int degrees[] = {3, 5, 7, 9, 13};
+const double theta[] = {1.495585217958292e-2, 2.539398330063230e-1, 9.504178996162932e-1, 2.097847961257068e0, 5.371920351148152e0};
+
+const double b3[] = {120.0, 60.0, 12.0, 1.0};
+const double b5[] = {30240.0, 15120.0, 3360.0, 420.0, 30.0, 1.0};
+const double b7[] = {17297280.0, 8648640.0, 1995840.0, 277200.0, 25200.0, 1512.0, 56.0, 1.0};
+const double b9[] = {17643225600.0, 8821612800.0, 2075673600.0, 302702400.0, 30270240.0, 2162160.0, 110880.0, 3960.0, 90.0, 1.0};
+const double b13[] = {64764752532480000.0, 32382376266240000.0, 7771770303897600.0, 1187353796428800.0, 129060195264000.0,
+                      10559470521600.0, 670442572800.0, 33522128640.0, 1323241920.0, 40840800.0, 960960.0, 16380.0, 182.0, 1.0};
+
+//Largest absolute column sum
+inline double norm1(const matrix<double> &a)
+{
+    double output = 0;
+    for (int x = 0; x < a.getWidth(); x++)
+    {
+        double sum = 0;
+        for (int y = 0; y < a.getHeight(); y++)
+        {
+            sum += std::fabs(a(y, x));
+        }
+        if (sum > output)
+            output = sum;
+    }
+    return output;
+}
+
+//output = sum of c[i]*m[i] over count terms, plus diagonal*I
+inline void combine(matrix<double> &output, int count, const double* c, const matrix<double>* const* m, double diagonal)
+{
+    const int n = m[0]->getWidth();
+    if (output.getWidth() != n || output.getHeight() != n || !output.getData())
+    {
+        matrix<double> fresh(n, n);
+        output.swap(fresh);
+    }
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            double v = (x == y) ? diagonal : 0.0;
+            for (int i = 0; i < count; i++)
+            {
+                v += c[i] * (*m[i])(y, x);
+            }
+            output(y, x) = v;
+        }
+    }
+}
+
+/*
+Numerator and denominator of the degree m approximant, p(A) = V + U and q(A) = V - U, where U
+holds the odd powers of A and V the even ones
+*/
+inline void terms(const matrix<double> &a, int m, matrix<double> &u, matrix<double> &v)
+{
+    matrix<double> a2 = a * a;
+    matrix<double> odd;
+    if (m == 13)
+    {
+        matrix<double> a4 = a2 * a2;
+        matrix<double> a6 = a4 * a2;
+        const double* b = b13;
+        const matrix<double>* high[] = {&a6, &a4, &a2};
+        matrix<double> tmp, tmp2;
+        const double oddHigh[] = {b[13], b[11], b[9]};
+        combine(tmp, 3, oddHigh, high, 0.0);
+        multiplyInto(a6, tmp, tmp2);
+        const matrix<double>* lower[] = {&tmp2, &a6, &a4, &a2};
+        const double oddLow[] = {1.0, b[7], b[5], b[3]};
+        combine(odd, 4, oddLow, lower, b[1]);
+        const double evenHigh[] = {b[12], b[10], b[8]};
+        combine(tmp, 3, evenHigh, high, 0.0);
+        multiplyInto(a6, tmp, tmp2);
+        const double evenLow[] = {1.0, b[6], b[4], b[2]};
+        combine(v, 4, evenLow, lower, b[0]);
+    }
+    else
+    {
+        const double* b = (m == 3) ? b3 : (m == 5) ? b5 : (m == 7) ? b7 : b9;
+        //Powers A^2, A^4, ... up to A^(m-1)
+        std::vector<matrix<double> > powers(1, a2);
+        for (int j = 4; j < m; j += 2)
+        {
+            powers.push_back(powers.back() * a2);
+        }
+        std::vector<const matrix<double>*> p(powers.size());
+        std::vector<double> oddC(powers.size()), evenC(powers.size());
+        for (size_t i = 0; i < powers.size(); i++)
+        {
+            p[i] = &powers[i];
+            oddC[i] = b[2*i + 3];
+            evenC[i] = b[2*i + 2];
+        }
+        combine(odd, static_cast<int>(p.size()), oddC.data(), p.data(), b[1]);
+        combine(v, static_cast<int>(p.size()), evenC.data(), p.data(), b[0]);
+    }
+    multiplyInto(a, odd, u);
+}
+
+}
+
+/*
+The matrix exponential e^A by scaling and squaring with a Pade approximant (Higham 2005).
+The smallest approximant degree accurate for the norm of A is used, and if even degree 13 is
+not, A is first scaled by 2^-s and the result squared s times, so the cost grows with log of the
+norm rather than with it.
+If the matrix is not square, dimension error is thrown.
+*/
+template <class Type>
+matrix<double> expm(const matrix<Type> &a)
+{
+    const int n = a.getWidth();
+    if (n != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    matrix<double> scaled = static_cast<matrix<double> >(a);
+    const double norm = pade::norm1(scaled);
+    int degree = 13;
+    int squarings = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        if (norm <= pade::theta[i])
+        {
+            degree = pade::degrees[i];
+            break;
+        }
+    }
+    if (degree == 13 && norm > pade::theta[4])
+    {
+        squarings = static_cast<int>(std::ceil(std::log2(norm / pade::theta[4])));
+        double scale = std::ldexp(1.0, -squarings);
+        for (int y = 0; y < n; y++)
+        {
+            for (int x = 0; x < n; x++)
+            {
+                scaled(y, x) *= scale;
+            }
+        }
+    }
+    matrix<double> u, v;
+    pade::terms(scaled, degree, u, v);
+    matrix<double> numerator(n, n), denominator(n, n);
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            numerator(y, x) = v(y, x) + u(y, x);
+            denominator(y, x) = v(y, x) - u(y, x);
+        }
+    }
+    matrix<double> result = luDecomposition(denominator).solve(numerator);
+    matrix<double> scratch;
+    for (int i = 0; i < squarings; i++)
+    {
+        multiplyInto(result, result, scratch);
+        result.swap(scratch);
+    }
+    return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,344 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_QR_H
+#define MATRIX_QR_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "matrix.h"
+
+namespace Matrix
+{
+
+/*
+Householder QR, A = QR, of a matrix at least as tall as it is wide, held in double precision.
+Columns are factored in panels of blockSize. Each panel's reflectors are gathered into the
+compact WY form I - V T V^T, so the rest of the matrix is updated by two products with V instead
+of one rank one update per column, and those updates are shared out over the thread pool.
+R is stored on and above the diagonal, the reflectors below it.
+If the matrix is wider than it is tall, dimension error is thrown.
+*/
+class qrDecomposition
+{
+public:
+    template <class Type>
+    explicit qrDecomposition(const matrix<Type> &a);
+    int getRows()const
+    {
+        return rows;
+    };
+    int getColumns()const
+    {
+        return columns;
+    };
+    matrix<double> getR()const;
+    matrix<double> applyQTranspose(const matrix<double> &b)const;
+    matrix<double> solve(const matrix<double> &b)const;
+private:
+    static const int blockSize = 32;
+    void factor();
+    void reflect(int j);
+    void formT(int j0, int width, std::vector<double> &t)const;
+    void applyBlock(int j0, int width, const std::vector<double> &t, double* c, int stride, int first, int last)const;
+    int rows;
+    int columns;
+    matrix<double> qr;
+    std::vector<double> tau;
+    //One width*width triangular factor per panel
+    std::vector<std::vector<double> > blocks;
+};
+
+template <class Type>
+qrDecomposition::qrDecomposition(const matrix<Type> &a)
+    : rows(a.getHeight()), columns(a.getWidth()), qr(static_cast<matrix<double> >(a)), tau(a.getWidth(), 0.0)
+{
+    if (rows < columns)
+        throw matrixException(DIMENSION_ERROR);
+    factor();
+}
+
+/*
+Householder reflector for column j, as LAPACK's dlarfg: H = I - tau v v^T with v(j) = 1, chosen so
+H maps the column from the diagonal down onto beta e_j.
+*/
+inline void qrDecomposition::reflect(int j)
+{
+    double* data = qr.getData();
+    const int stride = qr.getStride();
+    double alpha = data[j*stride + j];
+    double norm = 0;
+    for (int y = j + 1; y < rows; y++)
+    {
+        norm += data[y*stride + j] * data[y*stride + j];
+    }
+    if (norm == 0.0)
+    {
+        tau[j] = 0.0;
+        return;
+    }
+    double beta = -std::copysign(std::sqrt(alpha*alpha + norm), alpha);
+    tau[j] = (beta - alpha) / beta;
+    const double scale = 1.0 / (alpha - beta);
+    for (int y = j + 1; y < rows; y++)
+    {
+        data[y*stride + j] *= scale;
+    }
+    data[j*stride + j] = beta;
+}
+
+/*
+The triangular factor T of a panel, forward and column wise as LAPACK's dlarft:
+T(i,i) = tau_i and T(0:i, i) = -tau_i T(0:i, 0:i) V(:, 0:i)^T v_i
+*/
+inline void qrDecomposition::formT(int j0, int width, std::vector<double> &t)const
+{
+    const double* data = qr.getData();
+    const int stride = qr.getStride();
+    t.assign(static_cast<size_t>(width) * width, 0.0);
+    std::vector<double> w(width);
+    for (int i = 0; i < width; i++)
+    {
+        const int col = j0 + i;
+        //w(r) = v_r^T v_i for r < i, v_i is zero above row col and 1 on it
+        for (int r = 0; r < i; r++)
+        {
+            double s = data[col*stride + j0 + r];
+            for (int y = col + 1; y < rows; y++)
+            {
+                s += data[y*stride + j0 + r] * data[y*stride + col];
+            }
+            w[r] = s;
+        }
+        for (int r = 0; r < i; r++)
+        {
+            double s = 0;
+            for (int q = r; q < i; q++)
+            {
+                s += t[r*width + q] * w[q];
+            }
+            t[r*width + i] = -tau[col] * s;
+        }
+        t[i*width + i] = tau[col];
+    }
+}
+
+/*
+Apply the transpose of a panel's block reflector, C = (I - V T^T V^T) C, to columns [first, last)
+of the block c, whose row y is at c + y*stride. The reflectors only touch rows j0 and down.
+*/
+inline void qrDecomposition::applyBlock(int j0, int width, const std::vector<double> &t, double* c, int stride, int first, int last)const
+{
+    const double* data = qr.getData();
+    const int qrStride = qr.getStride();
+    const int count = last - first;
+    if (count <= 0)
+        return;
+    //W = V^T C
+    std::vector<double> w(static_cast<size_t>(width) * count, 0.0);
+    for (int y = j0; y < rows; y++)
+    {
+        const double* cRow = c + static_cast<size_t>(y)*stride + first;
+        const int top = (y - j0 + 1 < width) ? y - j0 + 1 : width;
+        for (int r = 0; r < top; r++)
+        {
+            const double v = (y == j0 + r) ? 1.0 : data[y*qrStride + j0 + r];
+            double* wRow = w.data() + static_cast<size_t>(r)*count;
+            for (int x = 0; x < count; x++)
+            {
+                wRow[x] += v * cRow[x];
+            }
+        }
+    }
+    //W = T^T W, from the bottom up so each row only reads rows not yet replaced
+    for (int r = width - 1; r >= 0; r--)
+    {
+        double* wRow = w.data() + static_cast<size_t>(r)*count;
+        const double diagonal = t[r*width + r];
+        for (int x = 0; x < count; x++)
+        {
+            wRow[x] *= diagonal;
+        }
+        for (int q = 0; q < r; q++)
+        {
+            const double f = t[q*width + r];
+            if (f == 0.0)
+                continue;
+            const double* qRow = w.data() + static_cast<size_t>(q)*count;
+            for (int x = 0; x < count; x++)
+            {
+                wRow[x] += f * qRow[x];
+            }
+        }
+    }
+    //C = C - V W
+    for (int y = j0; y < rows; y++)
+    {
+        double* cRow = c + static_cast<size_t>(y)*stride + first;
+        const int top = (y - j0 + 1 < width) ? y - j0 + 1 : width;
+        for (int r = 0; r < top; r++)
+        {
+            const double v = (y == j0 + r) ? 1.0 : data[y*qrStride + j0 + r];
+            const double* wRow = w.data() + static_cast<size_t>(r)*count;
+            for (int x = 0; x < count; x++)
+            {
+                cRow[x] -= v * wRow[x];
+            }
+        }
+    }
+}
+
+inline void qrDecomposition::factor()
+{
+    double* data = qr.getData();
+    const int stride = qr.getStride();
+    const int columnBlock = 64;
+    for (int j0 = 0; j0 < columns; j0 += blockSize)
+    {
+        const int width = (j0 + blockSize < columns) ? blockSize : columns - j0;
+        for (int j = j0; j < j0 + width; j++)
+        {
+            reflect(j);
+            //Apply H_j to the rest of the panel
+            if (tau[j] == 0.0)
+                continue;
+            for (int x = j + 1; x < j0 + width; x++)
+            {
+                double s = data[j*stride + x];
+                for (int y = j + 1; y < rows; y++)
+                {
+                    s += data[y*stride + j] * data[y*stride + x];
+                }
+                s *= tau[j];
+                data[j*stride + x] -= s;
+                for (int y = j + 1; y < rows; y++)
+                {
+                    data[y*stride + x] -= s * data[y*stride + j];
+                }
+            }
+        }
+        blocks.push_back(std::vector<double>());
+        formT(j0, width, blocks.back());
+        const std::vector<double> &t = blocks.back();
+        threadPool::instance().parallelFor(j0 + width, columns, columnBlock, [&](int first, int last)
+        {
+            applyBlock(j0, width, t, data, stride, first, last);
+        });
+    }
+}
+
+//The upper triangular factor, columns*columns
+inline matrix<double> qrDecomposition::getR()const
+{
+    matrix<double> output(columns, columns);
+    for (int y = 0; y < columns; y++)
+    {
+        for (int x = 0; x < columns; x++)
+        {
+            output(y, x) = (x >= y) ? qr(y, x) : 0.0;
+        }
+    }
+    return output;
+}
+
+/*
+Q^T B, one panel at a time in the order they were factored.
+Blocks of columns of B are independent and are shared out over the thread pool.
+*/
+inline matrix<double> qrDecomposition::applyQTranspose(const matrix<double> &b)const
+{
+    if (b.getHeight() != rows)
+        throw matrixException(DIMENSION_ERROR);
+    matrix<double> output(b);
+    double* data = output.getData();
+    const int stride = output.getStride();
+    const int columnBlock = 64;
+    threadPool::instance().parallelFor(0, output.getWidth(), columnBlock, [&](int first, int last)
+    {
+        for (size_t p = 0; p < blocks.size(); p++)
+        {
+            const int j0 = static_cast<int>(p) * blockSize;
+            const int width = (j0 + blockSize < columns) ? blockSize : columns - j0;
+            applyBlock(j0, width, blocks[p], data, stride, first, last);
+        }
+    });
+    return output;
+}
+
+/*
+Least squares solution of AX = B, minimising the 2-norm of AX - B for each column of B, by
+solving R X = (Q^T B) restricted to its first columns rows. For a square A this is the ordinary
+solution.
+If A does not have full column rank (to working precision), math error is thrown.
+*/
+inline matrix<double> qrDecomposition::solve(const matrix<double> &b)const
+{
+    double largest = 0;
+    for (int i = 0; i < columns; i++)
+    {
+        largest = std::max(largest, std::fabs(qr(i, i)));
+    }
+    const double tolerance = largest * rows * std::numeric_limits<double>::epsilon();
+    for (int i = 0; i < columns; i++)
+    {
+        if (!(std::fabs(qr(i, i)) > tolerance))
+            throw matrixException(MATH_ERROR);
+    }
+    matrix<double> y = applyQTranspose(b);
+    const int k = b.getWidth();
+    matrix<double> output(k, columns);
+    for (int i = columns - 1; i >= 0; i--)
+    {
+        for (int x = 0; x < k; x++)
+        {
+            output(i, x) = y(i, x);
+        }
+        for (int j = i + 1; j < columns; j++)
+        {
+            const double f = qr(i, j);
+            for (int x = 0; x < k; x++)
+            {
+                output(i, x) -= f * output(j, x);
+            }
+        }
+        const double inv = 1.0 / qr(i, i);
+        for (int x = 0; x < k; x++)
+        {
+            output(i, x) *= inv;
+        }
+    }
+    return output;
+}
+
+/*
+Moore-Penrose pseudo-inverse of a full rank matrix, width*height in and height*width out.
+A tall matrix gives the least squares solution against the identity, R^-1 Q^T, and a wide one is
+handled through its transpose, since pinv(A) = pinv(A^T)^T.
+If the matrix is rank deficient, math error is thrown.
+*/
+template <class Type>
+matrix<double> pseudoInverse(const matrix<Type> &a)
+{
+    matrix<double> work = static_cast<matrix<double> >(a);
+    const bool tall = work.getHeight() >= work.getWidth();
+    if (!tall)
+        work = transpose(work);
+    const int m = work.getHeight();
+    matrix<double> identity(m, m);
+    for (int y = 0; y < m; y++)
+    {
+        for (int x = 0; x < m; x++)
+        {
+            identity(y, x) = (x == y) ? 1.0 : 0.0;
+        }
+    }
+    matrix<double> output = qrDecomposition(work).solve(identity);
+    return tall ? output : transpose(output);
+}
+
+}
+
+#endif
@@ -0,0 +1,276 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_SCHUR_H
+#define MATRIX_SCHUR_H
+
+#include <vector>
+#include <cmath>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include "matrix.h"
+
+namespace Matrix
+{
+
+/*
+Recursive block inversion. Split A into
+
+        [A11  A12]              [X11 + T S^-1 U    -T S^-1]
+    A = [A21  A22]     A^-1 =   [-S^-1 U             S^-1]
+
+with X11 = A11^-1, T = X11 A12, U = A21 X11 and S = A22 - A21 T, the Schur complement of A11.
+A11 and S are inverted the same way until they are no bigger than the base size, where a pivoted
+Gauss-Jordan kernel takes over. Halving at every level makes the recursion cache oblivious, and
+nearly all of the work lands in the matrix products, so it runs at the speed of operator*.
+Products that do not depend on each other are run as parallel tasks.
+*/
+namespace schur
+{
+
+/*
+Below this Gauss-Jordan takes over. Timing 32 to 256 made little difference to the total, since
+the products dominate, so the smaller end is used to leave more independent tasks for the pool.
+*/
+const int baseSize = 64;
+
+/*
+Invert the n*n block at a (row y at a + y*stride) in place by Gauss-Jordan elimination with row
+pivoting: each row swap becomes a column swap of the inverse, undone at the end.
+Rows are eliminated in parallel once the matrix is big enough to be worth it.
+Returns false if the block is singular, leaving it undefined.
+*/
+inline bool gaussJordan(double* a, int stride, int n)
+{
+    std::vector<int> pivot(n);
+    const int grain = 1 + 32768 / (n + 1);
+    for (int k = 0; k < n; k++)
+    {
+        checkpoint();
+        int p = k;
+        double best = std::fabs(a[static_cast<size_t>(k)*stride + k]);
+        for (int i = k + 1; i < n; i++)
+        {
+            double v = std::fabs(a[static_cast<size_t>(i)*stride + k]);
+            if (v > best)
+            {
+                best = v;
+                p = i;
+            }
+        }
+        if (best == 0.0)
+            return false;
+        pivot[k] = p;
+        double* rowK = a + static_cast<size_t>(k)*stride;
+        if (p != k)
+            std::swap_ranges(rowK, rowK + n, a + static_cast<size_t>(p)*stride);
+        const double inv = 1.0 / rowK[k];
+        rowK[k] = 1.0;
+        for (int x = 0; x < n; x++)
+        {
+            rowK[x] *= inv;
+        }
+        threadPool::instance().parallelFor(0, n, grain, [=](int first, int last)
+        {
+            for (int i = first; i < last; i++)
+            {
+                if (i == k)
+                    continue;
+                double* rowI = a + static_cast<size_t>(i)*stride;
+                const double f = rowI[k];
+                if (f == 0.0)
+                    continue;
+                rowI[k] = 0.0;
+                for (int x = 0; x < n; x++)
+                {
+                    rowI[x] -= f * rowK[x];
+                }
+            }
+        });
+        reportProgress(static_cast<long long>(n) * n);
+    }
+    for (int k = n - 1; k >= 0; k--)
+    {
+        if (pivot[k] == k)
+            continue;
+        for (int y = 0; y < n; y++)
+        {
+            std::swap(a[static_cast<size_t>(y)*stride + k], a[static_cast<size_t>(y)*stride + pivot[k]]);
+        }
+    }
+    return true;
+}
+
+//Copy of the height*width block of a at (y0, x0)
+inline matrix<double> extract(const matrix<double> &a, int y0, int x0, int height, int width)
+{
+    matrix<double> output(width, height);
+    for (int y = 0; y < height; y++)
+    {
+        std::copy(a.getData() + static_cast<size_t>(y0 + y)*a.getStride() + x0,
+                  a.getData() + static_cast<size_t>(y0 + y)*a.getStride() + x0 + width,
+                  output.getData() + static_cast<size_t>(y)*output.getStride());
+    }
+    return output;
+}
+
+//out(y0.., x0..) = scale * b
+inline void place(matrix<double> &out, int y0, int x0, const matrix<double> &b, double scale)
+{
+    for (int y = 0; y < b.getHeight(); y++)
+    {
+        const double* in = b.getData() + static_cast<size_t>(y)*b.getStride();
+        double* row = out.getData() + static_cast<size_t>(y0 + y)*out.getStride() + x0;
+        for (int x = 0; x < b.getWidth(); x++)
+        {
+            row[x] = scale * in[x];
+        }
+    }
+}
+
+/*
+out = a^-1 for a square a, by the block formula above. Returns false if A11 or S is singular at
+some level, which can happen even when A is not, since the blocks are not pivoted.
+*/
+inline bool invert(const matrix<double> &a, matrix<double> &out, int base)
+{
+    const int n = a.getWidth();
+    if (n <= base)
+    {
+        out = a;
+        return gaussJordan(out.getData(), out.getStride(), n);
+    }
+    //Split on a multiple of 8 so the products' SIMD tiles line up, as long as both halves are left
+    const int n1 = (n >= 16) ? (n / 2) & ~7 : n / 2;
+    const int n2 = n - n1;
+    matrix<double> x11(n1, n1);
+    if (!invert(extract(a, 0, 0, n1, n1), x11, base))
+        return false;
+    const matrix<double> a12 = extract(a, 0, n1, n1, n2);
+    const matrix<double> a21 = extract(a, n1, 0, n2, n1);
+    const matrix<double> t = x11 * a12;
+    matrix<double> u(n1, n2), s(n2, n2), sInverse(n2, n2);
+    bool regular = true;
+    threadPool::instance().parallelInvoke([&]()
+    {
+        u = a21 * x11;
+    }, [&]()
+    {
+        s = extract(a, n1, n1, n2, n2) - a21 * t;
+        regular = invert(s, sInverse, base);
+    });
+    if (!regular)
+        return false;
+    threadPool::instance().parallelInvoke([&]()
+    {
+        //W = S^-1 U gives both bottom left, -W, and top left, X11 + T W
+        matrix<double> w = sInverse * u;
+        place(out, n1, 0, w, -1.0);
+        place(out, 0, 0, x11 + t * w, 1.0);
+    }, [&]()
+    {
+        place(out, 0, n1, t * sInverse, -1.0);
+        place(out, n1, n1, sInverse, 1.0);
+    });
+    return true;
+}
+
+/*
+Normwise backward error of X as an inverse of A, tried on a random +-1 vector v drawn from probes:
+with y = X v, |A y - v| / (|A| |y| + |v|) in the max norm. A stable inverse keeps this near machine
+precision whatever the condition of A, and it costs O(n^2) against the O(n^3) of finding X.
+*/
+inline double residual(const matrix<double> &a, const matrix<double> &x, std::mt19937 &probes)
+{
+    const int n = a.getWidth();
+    std::vector<double> v(n), y(n);
+    for (int i = 0; i < n; i++)
+    {
+        v[i] = (probes() & 1) ? 1.0 : -1.0;
+    }
+    double normY = 0;
+    for (int i = 0; i < n; i++)
+    {
+        y[i] = simd::dot(x.getData() + static_cast<size_t>(i)*x.getStride(), v.data(), n);
+        normY = std::max(normY, std::fabs(y[i]));
+    }
+    double normA = 0;
+    double worst = 0;
+    for (int i = 0; i < n; i++)
+    {
+        const double* row = a.getData() + static_cast<size_t>(i)*a.getStride();
+        worst = std::max(worst, std::fabs(simd::dot(row, y.data(), n) - v[i]));
+        double sum = 0;
+        for (int j = 0; j < n; j++)
+        {
+            sum += std::fabs(row[j]);
+        }
+        normA = std::max(normA, sum);
+    }
+    return worst / (normA * normY + 1.0);
+}
+
+//As above, with the same probe every time so a result can be reproduced
+inline double residual(const matrix<double> &a, const matrix<double> &x)
+{
+    std::mt19937 probes(0x5eed);
+    return residual(a, x, probes);
+}
+
+}
+
+/*
+Invert a square matrix by recursive Schur complements, with blocks of base (default
+schur::baseSize) or smaller inverted directly. The blocks are not pivoted against each other,
+so accuracy can suffer, or a leading block can be singular when A is not. The result is
+therefore checked with schur::residual. A result that is only slightly off gets one Newton step,
+X = X + X (I - A X), which costs two more products and squares the error. Anything worse is
+inverted again by Gauss-Jordan with row pivoting over the whole matrix.
+If the matrix is not square, dimension error is thrown.
+If the matrix is singular, math error is thrown.
+*/
+template <class Type>
+matrix<double> invertBlocked(const matrix<Type> &a, int base)
+{
+    if (a.getWidth() != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    if (base < 1)
+        base = schur::baseSize;
+    const int n = a.getWidth();
+    const matrix<double> work = static_cast<matrix<double> >(a);
+    matrix<double> output(n, n);
+    const double tolerance = n * std::numeric_limits<double>::epsilon();
+    const double refinable = std::sqrt(std::numeric_limits<double>::epsilon());
+    if (schur::invert(work, output, base))
+    {
+        double error = schur::residual(work, output);
+        if (error > tolerance && error <= refinable)
+        {
+            expectProgress(2LL*n*n*n);
+            matrix<double> r = work * output;
+            for (int y = 0; y < n; y++)
+            {
+                double* row = r.getData() + static_cast<size_t>(y)*r.getStride();
+                for (int x = 0; x < n; x++)
+                {
+                    row[x] = ((x == y) ? 1.0 : 0.0) - row[x];
+                }
+            }
+            output = output + output * r;
+            error = schur::residual(work, output);
+        }
+        if (error <= tolerance)
+            return output;
+    }
+    expectProgress(static_cast<long long>(n)*n*n);
+    output = work;
+    if (!schur::gaussJordan(output.getData(), output.getStride(), n))
+        throw matrixException(MATH_ERROR);
+    return output;
+}
+
+}
+
+#endif
@@ -0,0 +1,589 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_SIMD_H
+#define MATRIX_SIMD_H
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+Low level kernels working on contiguous arrays. The generic templates are written so the compiler
+can unroll them, float and double have hand written SSE2/AVX versions selected at compile time
+*/
+namespace Matrix
+{
+namespace simd
+{
+
+/*
+accumulator is the type arithmetic on Type is carried out in. It is Type itself except for the
+16 bit floating point storage types, which are summed in float so no precision is lost between
+partial sums
+*/
+template <class Type>
+struct accumulator
+{
+    typedef Type type;
+};
+
+//dot product of two arrays of length n
+template <class Type>
+inline Type dot(const Type* a, const Type* b, int n)
+{
+    typedef typename accumulator<Type>::type Wide;
+    Wide s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++)
+    {
+        s0 += a[i] * b[i];
+    }
+    return static_cast<Type>((s0 + s1) + (s2 + s3));
+}
+
+/*
+dot products of one array against four others at once, a is loaded once for all four
+products which halves the memory traffic of a matrix row against a block of vectors
+*/
+template <class Type>
+inline void dot4(const Type* a, const Type* b0, const Type* b1, const Type* b2, const Type* b3, int n, Type* out)
+{
+    typedef typename accumulator<Type>::type Wide;
+    Wide s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < n; i++)
+    {
+        Wide x = a[i];
+        s0 += x * b0[i];
+        s1 += x * b1[i];
+        s2 += x * b2[i];
+        s3 += x * b3[i];
+    }
+    out[0] = static_cast<Type>(s0);
+    out[1] = static_cast<Type>(s1);
+    out[2] = static_cast<Type>(s2);
+    out[3] = static_cast<Type>(s3);
+}
+
+#if defined(__AVX__)
+
+#if defined(__FMA__)
+#define MATRIX_FMADD_PD(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define MATRIX_FMADD_PS(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#define MATRIX_FMADD_PD(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+#define MATRIX_FMADD_PS(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+
+inline double hsum(__m256d v)
+{
+    __m128d lo = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+inline float hsum(__m256 v)
+{
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    return _mm_cvtss_f32(_mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1)));
+}
+
+template <>
+inline double dot<double>(const double* a, const double* b, int n)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        s0 = MATRIX_FMADD_PD(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), s0);
+        s1 = MATRIX_FMADD_PD(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), s1);
+    }
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 = MATRIX_FMADD_PD(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), s0);
+    }
+    double total = hsum(_mm256_add_pd(s0, s1));
+    for (; i < n; i++)
+    {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+template <>
+inline float dot<float>(const float* a, const float* b, int n)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        s0 = MATRIX_FMADD_PS(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = MATRIX_FMADD_PS(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        s0 = MATRIX_FMADD_PS(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    }
+    float total = hsum(_mm256_add_ps(s0, s1));
+    for (; i < n; i++)
+    {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+template <>
+inline void dot4<double>(const double* a, const double* b0, const double* b1, const double* b2, const double* b3, int n, double* out)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(a + i);
+        s0 = MATRIX_FMADD_PD(x, _mm256_loadu_pd(b0 + i), s0);
+        s1 = MATRIX_FMADD_PD(x, _mm256_loadu_pd(b1 + i), s1);
+        s2 = MATRIX_FMADD_PD(x, _mm256_loadu_pd(b2 + i), s2);
+        s3 = MATRIX_FMADD_PD(x, _mm256_loadu_pd(b3 + i), s3);
+    }
+    out[0] = hsum(s0);
+    out[1] = hsum(s1);
+    out[2] = hsum(s2);
+    out[3] = hsum(s3);
+    for (; i < n; i++)
+    {
+        out[0] += a[i] * b0[i];
+        out[1] += a[i] * b1[i];
+        out[2] += a[i] * b2[i];
+        out[3] += a[i] * b3[i];
+    }
+}
+
+template <>
+inline void dot4<float>(const float* a, const float* b0, const float* b1, const float* b2, const float* b3, int n, float* out)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(a + i);
+        s0 = MATRIX_FMADD_PS(x, _mm256_loadu_ps(b0 + i), s0);
+        s1 = MATRIX_FMADD_PS(x, _mm256_loadu_ps(b1 + i), s1);
+        s2 = MATRIX_FMADD_PS(x, _mm256_loadu_ps(b2 + i), s2);
+        s3 = MATRIX_FMADD_PS(x, _mm256_loadu_ps(b3 + i), s3);
+    }
+    out[0] = hsum(s0);
+    out[1] = hsum(s1);
+    out[2] = hsum(s2);
+    out[3] = hsum(s3);
+    for (; i < n; i++)
+    {
+        out[0] += a[i] * b0[i];
+        out[1] += a[i] * b1[i];
+        out[2] += a[i] * b2[i];
+        out[3] += a[i] * b3[i];
+    }
+}
+
+#elif defined(__SSE2__)
+
+inline double hsum(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+inline float hsum(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(v, _mm_shuffle_ps(v, v, 1)));
+}
+
+template <>
+inline double dot<double>(const double* a, const double* b, int n)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double total = hsum(_mm_add_pd(s0, s1));
+    for (; i < n; i++)
+    {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+template <>
+inline float dot<float>(const float* a, const float* b, int n)
+{
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float total = hsum(_mm_add_ps(s0, s1));
+    for (; i < n; i++)
+    {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+template <>
+inline void dot4<double>(const double* a, const double* b0, const double* b1, const double* b2, const double* b3, int n, double* out)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    __m128d s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(a + i);
+        s0 = _mm_add_pd(s0, _mm_mul_pd(x, _mm_loadu_pd(b0 + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(x, _mm_loadu_pd(b1 + i)));
+        s2 = _mm_add_pd(s2, _mm_mul_pd(x, _mm_loadu_pd(b2 + i)));
+        s3 = _mm_add_pd(s3, _mm_mul_pd(x, _mm_loadu_pd(b3 + i)));
+    }
+    out[0] = hsum(s0);
+    out[1] = hsum(s1);
+    out[2] = hsum(s2);
+    out[3] = hsum(s3);
+    for (; i < n; i++)
+    {
+        out[0] += a[i] * b0[i];
+        out[1] += a[i] * b1[i];
+        out[2] += a[i] * b2[i];
+        out[3] += a[i] * b3[i];
+    }
+}
+
+template <>
+inline void dot4<float>(const float* a, const float* b0, const float* b1, const float* b2, const float* b3, int n, float* out)
+{
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(a + i);
+        s0 = _mm_add_ps(s0, _mm_mul_ps(x, _mm_loadu_ps(b0 + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(x, _mm_loadu_ps(b1 + i)));
+        s2 = _mm_add_ps(s2, _mm_mul_ps(x, _mm_loadu_ps(b2 + i)));
+        s3 = _mm_add_ps(s3, _mm_mul_ps(x, _mm_loadu_ps(b3 + i)));
+    }
+    out[0] = hsum(s0);
+    out[1] = hsum(s1);
+    out[2] = hsum(s2);
+    out[3] = hsum(s3);
+    for (; i < n; i++)
+    {
+        out[0] += a[i] * b0[i];
+        out[1] += a[i] * b1[i];
+        out[2] += a[i] * b2[i];
+        out[3] += a[i] * b3[i];
+    }
+}
+
+#endif
+
+/*
+narrow converts one element, clamping to the range of the destination for the small integral
+types instead of wrapping. NaN maps to the lower limit, which matches the SIMD kernels below
+*/
+template <class To>
+struct narrow
+{
+    template <class From>
+    static To from(From x)
+    {
+        return static_cast<To>(x);
+    }
+};
+
+template <>
+struct narrow<short>
+{
+    template <class From>
+    static short from(From x)
+    {
+        return (x > 32767) ? static_cast<short>(32767) : ((x > -32768) ? static_cast<short>(x) : static_cast<short>(-32768));
+    }
+};
+
+template <>
+struct narrow<unsigned char>
+{
+    template <class From>
+    static unsigned char from(From x)
+    {
+        return (x > 255) ? static_cast<unsigned char>(255) : ((x > 0) ? static_cast<unsigned char>(x) : static_cast<unsigned char>(0));
+    }
+};
+
+//convert n elements from one type to another, see narrow for how out of range values are handled
+template <class From, class To>
+inline void convert(const From* in, To* out, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = narrow<To>::from(in[i]);
+    }
+}
+
+#if defined(__SSE2__)
+
+template <>
+inline void convert<float, double>(const float* in, double* out, int n)
+{
+    int i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_cvtps_pd(_mm_loadu_ps(in + i)));
+    }
+#else
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(in + i);
+        _mm_storeu_pd(out + i, _mm_cvtps_pd(x));
+        _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = in[i];
+    }
+}
+
+template <>
+inline void convert<double, float>(const double* in, float* out, int n)
+{
+    int i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i)));
+    }
+#else
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+        _mm_storeu_ps(out + i, _mm_movelh_ps(lo, hi));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = static_cast<float>(in[i]);
+    }
+}
+
+template <>
+inline void convert<int, float>(const int* in, float* out, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = static_cast<float>(in[i]);
+    }
+}
+
+template <>
+inline void convert<int, double>(const int* in, double* out, int n)
+{
+    int i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+    }
+#else
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_pd(out + i, _mm_cvtepi32_pd(x));
+        _mm_storeu_pd(out + i + 2, _mm_cvtepi32_pd(_mm_unpackhi_epi64(x, x)));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = in[i];
+    }
+}
+
+//float and double to int truncate like static_cast, out of range values become INT_MIN
+template <>
+inline void convert<float, int>(const float* in, int* out, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvttps_epi32(_mm_loadu_ps(in + i)));
+    }
+    //The scalar instruction, since static_cast is undefined where the vector one gives INT_MIN
+    for (; i < n; i++)
+    {
+        out[i] = _mm_cvttss_si32(_mm_set_ss(in[i]));
+    }
+}
+
+template <>
+inline void convert<double, int>(const double* in, int* out, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i lo = _mm_cvttpd_epi32(_mm_loadu_pd(in + i));
+        __m128i hi = _mm_cvttpd_epi32(_mm_loadu_pd(in + i + 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi64(lo, hi));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = _mm_cvttsd_si32(_mm_set_sd(in[i]));
+    }
+}
+
+//Saturating narrowing, packs clamps int32 to int16 and packus clamps int16 to uint8
+template <>
+inline void convert<int, short>(const int* in, short* out, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = narrow<short>::from(in[i]);
+    }
+}
+
+template <>
+inline void convert<int, unsigned char>(const int* in, unsigned char* out, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m128i* src = reinterpret_cast<const __m128i*>(in + i);
+        __m128i lo = _mm_packs_epi32(_mm_loadu_si128(src), _mm_loadu_si128(src + 1));
+        __m128i hi = _mm_packs_epi32(_mm_loadu_si128(src + 2), _mm_loadu_si128(src + 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = narrow<unsigned char>::from(in[i]);
+    }
+}
+
+/*
+Floating point sources are clamped into range before truncation, so large values cannot wrap
+through the INT_MIN result of cvttps. max(x, lo) returns lo for NaN
+*/
+inline __m128i clampToInt(__m128 x, float lo, float hi)
+{
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x, _mm_set1_ps(lo)), _mm_set1_ps(hi)));
+}
+
+inline __m128i clampToInt(const double* in, double lo, double hi)
+{
+    __m128d l = _mm_set1_pd(lo), h = _mm_set1_pd(hi);
+    __m128i a = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_loadu_pd(in), l), h));
+    __m128i b = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(_mm_loadu_pd(in + 2), l), h));
+    return _mm_unpacklo_epi64(a, b);
+}
+
+template <>
+inline void convert<float, short>(const float* in, short* out, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i lo = clampToInt(_mm_loadu_ps(in + i), -32768.0f, 32767.0f);
+        __m128i hi = clampToInt(_mm_loadu_ps(in + i + 4), -32768.0f, 32767.0f);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = narrow<short>::from(in[i]);
+    }
+}
+
+template <>
+inline void convert<double, short>(const double* in, short* out, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i lo = clampToInt(in + i, -32768.0, 32767.0);
+        __m128i hi = clampToInt(in + i + 4, -32768.0, 32767.0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = narrow<short>::from(in[i]);
+    }
+}
+
+template <>
+inline void convert<float, unsigned char>(const float* in, unsigned char* out, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = clampToInt(_mm_loadu_ps(in + i), 0.0f, 255.0f);
+        __m128i b = clampToInt(_mm_loadu_ps(in + i + 4), 0.0f, 255.0f);
+        __m128i c = clampToInt(_mm_loadu_ps(in + i + 8), 0.0f, 255.0f);
+        __m128i d = clampToInt(_mm_loadu_ps(in + i + 12), 0.0f, 255.0f);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    for (; i < n; i++)
+    {
+        out[i] = narrow<unsigned char>::from(in[i]);
+    }
+}
+
+template <>
+inline void convert<double, unsigned char>(const double* in, unsigned char* out, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = clampToInt(in + i, 0.0, 255.0);
+        __m128i b = clampToInt(in + i + 4, 0.0, 255.0);
+        __m128i c = clampToInt(in + i + 8, 0.0, 255.0);
+        __m128i d = clampToInt(in + i + 12, 0.0, 255.0);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    for (; i < n; i++)
+    {
+        out[i] = narrow<unsigned char>::from(in[i]);
+    }
+}
+
+#endif
+
+}
+}
+
+#endif
@@ -0,0 +1,538 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_STRUCTURE_H
+#define MATRIX_STRUCTURE_H
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include "matrixError.h"
+#include "matrixThreads.h"
+
+namespace Matrix
+{
+
+/*
+Many matrices met in practice have zeros in known places: the sample in matrix.txt is upper
+triangular. A single O(n^2) pass finds that shape, and inverting, taking the determinant of or
+solving against a shaped matrix can then skip the work the zeros make pointless.
+Like blas::routines, every kernel here works on a row major block with a stride and returns true
+if it handled the call, so the dense code is left as the fallback.
+*/
+namespace structure
+{
+
+struct shape
+{
+    int n;
+    //Furthest non zero below and above the diagonal, 0 and 0 for a diagonal matrix
+    int lowerBandwidth;
+    int upperBandwidth;
+    bool symmetric;
+    //Exactly one 1 in each row and column and zeros elsewhere
+    bool permutation;
+    bool diagonal()const
+    {
+        return lowerBandwidth == 0 && upperBandwidth == 0;
+    };
+    bool upper()const
+    {
+        return lowerBandwidth == 0;
+    };
+    bool lower()const
+    {
+        return upperBandwidth == 0;
+    };
+    //The band is narrow enough next to n for bandFactor to beat a dense factorization
+    bool banded()const
+    {
+        return 2*(lowerBandwidth + upperBandwidth) < n;
+    };
+};
+
+template <class Type>
+shape detect(const Type* a, int stride, int n)
+{
+    shape s;
+    s.n = n;
+    s.lowerBandwidth = 0;
+    s.upperBandwidth = 0;
+    s.symmetric = true;
+    s.permutation = true;
+    std::vector<int> columnOnes(n, 0);
+    for (int y = 0; y < n; y++)
+    {
+        const Type* row = a + static_cast<size_t>(y)*stride;
+        int rowOnes = 0;
+        for (int x = 0; x < n; x++)
+        {
+            const double v = static_cast<double>(row[x]);
+            if (v == 0.0)
+                continue;
+            if (x < y)
+                s.lowerBandwidth = std::max(s.lowerBandwidth, y - x);
+            else if (x > y)
+                s.upperBandwidth = std::max(s.upperBandwidth, x - y);
+            if (v == 1.0)
+            {
+                rowOnes++;
+                columnOnes[x]++;
+            }
+            else
+            {
+                s.permutation = false;
+            }
+        }
+        if (rowOnes != 1)
+            s.permutation = false;
+        for (int x = y + 1; x < n && s.symmetric; x++)
+        {
+            if (static_cast<double>(row[x]) != static_cast<double>(a[static_cast<size_t>(x)*stride + y]))
+                s.symmetric = false;
+        }
+    }
+    for (int x = 0; x < n; x++)
+    {
+        if (columnOnes[x] != 1)
+            s.permutation = false;
+    }
+    return s;
+}
+
+//A short name for the shape, as the stats output prints it
+inline std::string describe(const shape &s)
+{
+    if (s.permutation && !s.diagonal())
+        return "permutation";
+    if (s.diagonal())
+        return "diagonal";
+    if (s.upper())
+        return "upper triangular";
+    if (s.lower())
+        return "lower triangular";
+    std::ostringstream out;
+    if (s.symmetric)
+        out << "symmetric";
+    if (s.banded())
+        out << (s.symmetric ? " " : "") << "banded (" << s.lowerBandwidth << " below, " << s.upperBandwidth << " above)";
+    if (!s.symmetric && !s.banded())
+        out << "general";
+    return out.str();
+}
+
+/*
+The determinant of a triangular matrix is the product of its diagonal, and that of a permutation
+matrix the sign of the permutation. Both are exact in Type, so they are taken even for integers.
+The checks give up at the first entry that rules a shape out, which for a dense matrix is almost
+at once, so calling this on every minor of a cofactor expansion costs next to nothing.
+*/
+template <class Type>
+bool determinant(const Type* a, int stride, int n, Type &out)
+{
+    bool upper = true;
+    bool lower = true;
+    for (int y = 0; y < n && (upper || lower); y++)
+    {
+        const Type* row = a + static_cast<size_t>(y)*stride;
+        for (int x = 0; x < n; x++)
+        {
+            if (x != y && static_cast<double>(row[x]) != 0.0)
+            {
+                if (x < y)
+                    upper = false;
+                else
+                    lower = false;
+                if (!upper && !lower)
+                    break;
+            }
+        }
+    }
+    if (upper || lower)
+    {
+        out = a[0];
+        for (int i = 1; i < n; i++)
+        {
+            out = out * a[static_cast<size_t>(i)*stride + i];
+        }
+        return true;
+    }
+    //Find the column of the one in each row, giving up on anything else
+    std::vector<int> column(n, -1);
+    std::vector<bool> used(n, false);
+    for (int y = 0; y < n; y++)
+    {
+        const Type* row = a + static_cast<size_t>(y)*stride;
+        for (int x = 0; x < n; x++)
+        {
+            const double v = static_cast<double>(row[x]);
+            if (v == 0.0)
+                continue;
+            if (v != 1.0 || column[y] >= 0 || used[x])
+                return false;
+            column[y] = x;
+            used[x] = true;
+        }
+        if (column[y] < 0)
+            return false;
+    }
+    //Each cycle of length l is l - 1 transpositions
+    int parity = 0;
+    std::vector<bool> seen(n, false);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = i; !seen[j]; j = column[j])
+        {
+            seen[j] = true;
+            if (column[j] != i)
+                parity ^= 1;
+        }
+    }
+    out = static_cast<Type>(parity ? -1 : 1);
+    return true;
+}
+
+/*
+Row pivoted LU of a dense double matrix that is zero outside the band. Rows are only searched
+kl below the diagonal for a pivot, and a swap can push U's band out to kl + ku, so each step
+updates kl rows over kl + ku columns: O(n kl (kl + ku)) instead of O(n^3).
+Without pivoting (safe for a lower triangular matrix, whose elimination never fills in), pivot
+stays the identity. Math error is thrown if the matrix is singular.
+*/
+inline void bandFactor(double* a, int stride, int n, int kl, int ku, bool pivoting, int* pivot, int &sign)
+{
+    sign = 1;
+    for (int k = 0; k < n; k++)
+    {
+        checkpoint();
+        const int bottom = std::min(n, k + kl + 1);
+        const int right = std::min(n, k + kl + ku + 1);
+        int p = k;
+        if (pivoting)
+        {
+            double best = std::fabs(a[static_cast<size_t>(k)*stride + k]);
+            for (int i = k + 1; i < bottom; i++)
+            {
+                double v = std::fabs(a[static_cast<size_t>(i)*stride + k]);
+                if (v > best)
+                {
+                    best = v;
+                    p = i;
+                }
+            }
+        }
+        if (a[static_cast<size_t>(p)*stride + k] == 0.0)
+            throw matrixException(MATH_ERROR);
+        pivot[k] = p;
+        if (p != k)
+        {
+            sign = -sign;
+            std::swap_ranges(a + static_cast<size_t>(k)*stride, a + static_cast<size_t>(k)*stride + n, a + static_cast<size_t>(p)*stride);
+        }
+        const double* rowK = a + static_cast<size_t>(k)*stride;
+        const double inv = 1.0 / rowK[k];
+        for (int i = k + 1; i < bottom; i++)
+        {
+            double* rowI = a + static_cast<size_t>(i)*stride;
+            double l = rowI[k] * inv;
+            rowI[k] = l;
+            if (l == 0.0)
+                continue;
+            for (int x = k + 1; x < right; x++)
+            {
+                rowI[x] -= l * rowK[x];
+            }
+        }
+        reportProgress(static_cast<long long>(bottom - k - 1) * (right - k - 1));
+    }
+}
+
+/*
+Inverse of an upper (or, with lower set, lower) triangular matrix, built a row at a time:
+row i of X is (e_i - sum over k of A(i,k) X(k,:)) / A(i,i), with k running over the other non zero
+entries of row i of A. Rows of X are only non zero on their own side of the diagonal, so this is
+about n^3/6 multiply adds.
+*/
+template <class Type>
+void invertTriangular(const Type* a, int stride, int n, bool lower, double* out, int ldo)
+{
+    for (int step = 0; step < n; step++)
+    {
+        checkpoint();
+        const int i = lower ? step : n - 1 - step;
+        const Type* row = a + static_cast<size_t>(i)*stride;
+        double* outI = out + static_cast<size_t>(i)*ldo;
+        std::fill(outI, outI + n, 0.0);
+        outI[i] = 1.0;
+        const int first = lower ? 0 : i + 1;
+        const int last = lower ? i : n;
+        for (int k = first; k < last; k++)
+        {
+            const double f = static_cast<double>(row[k]);
+            if (f == 0.0)
+                continue;
+            const double* outK = out + static_cast<size_t>(k)*ldo;
+            const int from = lower ? 0 : k;
+            const int to = lower ? k + 1 : n;
+            for (int x = from; x < to; x++)
+            {
+                outI[x] -= f * outK[x];
+            }
+        }
+        const double diagonal = static_cast<double>(row[i]);
+        if (diagonal == 0.0)
+            throw matrixException(MATH_ERROR);
+        const double inv = 1.0 / diagonal;
+        for (int x = 0; x < n; x++)
+        {
+            outI[x] *= inv;
+        }
+        reportProgress(static_cast<long long>(last - first) * (last - first + 1) / 2);
+    }
+}
+
+/*
+A symmetric matrix is first tried as positive definite: A = L L^T by Cholesky, then
+A^-1 = L^-T L^-1 from the triangular inverse. Returns false, leaving out undefined, as soon as a
+pivot is not positive, so an indefinite matrix costs at most one partial factorization.
+*/
+template <class Type>
+bool invertSymmetric(const Type* a, int stride, int n, double* out, int ldo)
+{
+    std::vector<double> l(static_cast<size_t>(n) * n, 0.0);
+    for (int j = 0; j < n; j++)
+    {
+        checkpoint();
+        double* rowJ = l.data() + static_cast<size_t>(j)*n;
+        double d = static_cast<double>(a[static_cast<size_t>(j)*stride + j]);
+        for (int k = 0; k < j; k++)
+        {
+            d -= rowJ[k] * rowJ[k];
+        }
+        if (!(d > 0.0))
+            return false;
+        rowJ[j] = std::sqrt(d);
+        const double inv = 1.0 / rowJ[j];
+        for (int i = j + 1; i < n; i++)
+        {
+            double* rowI = l.data() + static_cast<size_t>(i)*n;
+            double s = static_cast<double>(a[static_cast<size_t>(i)*stride + j]);
+            for (int k = 0; k < j; k++)
+            {
+                s -= rowI[k] * rowJ[k];
+            }
+            rowI[j] = s * inv;
+        }
+        reportProgress(static_cast<long long>(j) * (n - j));
+    }
+    std::vector<double> linv(static_cast<size_t>(n) * n);
+    invertTriangular(l.data(), n, n, true, linv.data(), n);
+    //out = Linv^T Linv, summed a row of Linv at a time over the lower half then mirrored
+    for (int y = 0; y < n; y++)
+    {
+        std::fill(out + static_cast<size_t>(y)*ldo, out + static_cast<size_t>(y)*ldo + n, 0.0);
+    }
+    for (int k = 0; k < n; k++)
+    {
+        checkpoint();
+        const double* rowK = linv.data() + static_cast<size_t>(k)*n;
+        for (int i = 0; i <= k; i++)
+        {
+            const double f = rowK[i];
+            double* outI = out + static_cast<size_t>(i)*ldo;
+            for (int j = 0; j <= i; j++)
+            {
+                outI[j] += f * rowK[j];
+            }
+        }
+        reportProgress(static_cast<long long>(k + 1) * (k + 2) / 2);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = i + 1; j < n; j++)
+        {
+            out[static_cast<size_t>(i)*ldo + j] = out[static_cast<size_t>(j)*ldo + i];
+        }
+    }
+    return true;
+}
+
+/*
+Invert a banded matrix with bandFactor, then solve against the identity. The forward pass skips
+the zeros of L and the back pass only reads U's band, so the whole inverse is O(n^2 (kl + ku)).
+*/
+template <class Type>
+void invertBanded(const Type* a, int stride, int n, int kl, int ku, double* out, int ldo)
+{
+    std::vector<double> lu(static_cast<size_t>(n) * n);
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            lu[static_cast<size_t>(y)*n + x] = static_cast<double>(a[static_cast<size_t>(y)*stride + x]);
+        }
+    }
+    std::vector<int> pivot(n);
+    int sign;
+    bandFactor(lu.data(), n, n, kl, ku, true, pivot.data(), sign);
+    //P applied to the identity
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+    for (int k = 0; k < n; k++)
+    {
+        std::swap(order[k], order[pivot[k]]);
+    }
+    for (int y = 0; y < n; y++)
+    {
+        double* outY = out + static_cast<size_t>(y)*ldo;
+        std::fill(outY, outY + n, 0.0);
+        outY[order[y]] = 1.0;
+    }
+    for (int i = 1; i < n; i++)
+    {
+        checkpoint();
+        const double* rowL = lu.data() + static_cast<size_t>(i)*n;
+        double* outI = out + static_cast<size_t>(i)*ldo;
+        long long work = 0;
+        for (int j = 0; j < i; j++)
+        {
+            const double f = rowL[j];
+            if (f == 0.0)
+                continue;
+            const double* outJ = out + static_cast<size_t>(j)*ldo;
+            for (int x = 0; x < n; x++)
+            {
+                outI[x] -= f * outJ[x];
+            }
+            work += n;
+        }
+        reportProgress(work);
+    }
+    const int width = kl + ku;
+    for (int i = n - 1; i >= 0; i--)
+    {
+        checkpoint();
+        const double* rowU = lu.data() + static_cast<size_t>(i)*n;
+        double* outI = out + static_cast<size_t>(i)*ldo;
+        const int last = std::min(n, i + width + 1);
+        long long work = n;
+        for (int j = i + 1; j < last; j++)
+        {
+            const double f = rowU[j];
+            if (f == 0.0)
+                continue;
+            const double* outJ = out + static_cast<size_t>(j)*ldo;
+            for (int x = 0; x < n; x++)
+            {
+                outI[x] -= f * outJ[x];
+            }
+            work += n;
+        }
+        const double inv = 1.0 / rowU[i];
+        for (int x = 0; x < n; x++)
+        {
+            outI[x] *= inv;
+        }
+        reportProgress(work);
+    }
+}
+
+/*
+Cholesky inverts a symmetric positive definite matrix in about n^3/2 multiply adds, but on one
+thread, while the dense path spreads its n^3 over the pool. So it is only tried first when there
+is no pool to speak of, or the matrix is too small for the dense path to go parallel.
+*/
+inline bool choleskyFirst(const shape &s)
+{
+    const int parallelSize = 64;
+    return s.symmetric && (s.n <= parallelSize || threadPool::instance().size() < 2);
+}
+
+/*
+About how many multiply-adds invert below spends on a matrix of shape s, which is what its kernels
+report as progress. A matrix with no usable shape is counted as a dense n^3 inverse.
+*/
+inline long long inverseWork(const shape &s)
+{
+    const long long n = s.n;
+    if (s.diagonal() || s.permutation)
+        return n*n;
+    if (s.upper() || s.lower())
+        return n*n*n/6;
+    if (s.banded())
+    {
+        const long long kl = s.lowerBandwidth;
+        const long long ku = s.upperBandwidth;
+        return n*kl*(kl + ku) + n*n*(2*kl + ku);
+    }
+    if (choleskyFirst(s))
+        return n*n*n/2;
+    return n*n*n;
+}
+
+/*
+out (n x n) = inverse of a, through the cheapest kernel its shape allows. Returns false for a
+matrix with no usable shape (or a symmetric one that is not positive definite, or that the
+parallel dense path will invert faster).
+If the matrix is singular, math error is thrown.
+*/
+template <class Type>
+bool invert(const Type* a, int stride, int n, double* out, int ldo)
+{
+    const shape s = detect(a, stride, n);
+    if (s.diagonal())
+    {
+        for (int y = 0; y < n; y++)
+        {
+            double* outY = out + static_cast<size_t>(y)*ldo;
+            std::fill(outY, outY + n, 0.0);
+            const double d = static_cast<double>(a[static_cast<size_t>(y)*stride + y]);
+            if (d == 0.0)
+                throw matrixException(MATH_ERROR);
+            outY[y] = 1.0 / d;
+        }
+        return true;
+    }
+    if (s.permutation)
+    {
+        //The inverse of a permutation is its transpose
+        for (int y = 0; y < n; y++)
+        {
+            for (int x = 0; x < n; x++)
+            {
+                out[static_cast<size_t>(x)*ldo + y] = static_cast<double>(a[static_cast<size_t>(y)*stride + x]);
+            }
+        }
+        return true;
+    }
+    if (s.upper() || s.lower())
+    {
+        invertTriangular(a, stride, n, s.lower(), out, ldo);
+        return true;
+    }
+    if (s.banded())
+    {
+        invertBanded(a, stride, n, s.lowerBandwidth, s.upperBandwidth, out, ldo);
+        return true;
+    }
+    if (choleskyFirst(s))
+    {
+        if (invertSymmetric(a, stride, n, out, ldo))
+            return true;
+        //The dense inverse the caller falls back to was not in inverseWork's estimate
+        expectProgress(static_cast<long long>(n) * n * n);
+    }
+    return false;
+}
+
+}
+
+}
+
+#endif
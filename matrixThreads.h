@@ -0,0 +1,505 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_THREADS_H
+#define MATRIX_THREADS_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include "matrixError.h"
+
+namespace Matrix
+{
+
+class taskGroup;
+
+/*
+asyncState is shared between an asynchronous operation and whoever started it: a flag asking it
+to stop, and the work done so far against an estimate of the total. While the operation runs its
+state is the current state of the thread running it, and the pool hands that on to every task the
+operation forks, so checkpoints deep inside parallel kernels see the same state.
+*/
+class asyncState
+{
+public:
+    asyncState() : cancelled(false), done(0), total(0) {};
+    static asyncState*& current()
+    {
+        static thread_local asyncState* state = nullptr;
+        return state;
+    };
+    std::atomic<bool> cancelled;
+    std::atomic<long long> done;
+    std::atomic<long long> total;
+};
+
+/*
+Called by long running kernels between steps, throws cancelled error if the operation running on
+this thread has been cancelled. Outside an asynchronous operation it does nothing.
+*/
+inline void checkpoint()
+{
+    asyncState* state = asyncState::current();
+    if (state && state->cancelled.load(std::memory_order_relaxed))
+        throw matrixException(CANCELLED_ERROR);
+}
+
+//Add work (in multiply-adds) to the progress of the operation running on this thread, if any
+inline void reportProgress(long long work)
+{
+    asyncState* state = asyncState::current();
+    if (state)
+        state->done.fetch_add(work, std::memory_order_relaxed);
+}
+
+//Add work to the estimated total of the operation running on this thread, for a step it did not plan on
+inline void expectProgress(long long work)
+{
+    asyncState* state = asyncState::current();
+    if (state)
+        state->total.fetch_add(work, std::memory_order_relaxed);
+}
+
+/*
+The CPUs of NUMA node, read from sysfs. Empty if the node does not exist, or if the system does
+not report its topology.
+*/
+inline std::vector<int> numaNodeCpus(int node)
+{
+    std::vector<int> cpus;
+    std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string range;
+    //cpulist is a comma separated list of single CPUs and first-last ranges
+    while (std::getline(list, range, ','))
+    {
+        int first = std::atoi(range.c_str());
+        size_t dash = range.find('-');
+        int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+        for (int c = first; c <= last; c++)
+            cpus.push_back(c);
+    }
+    return cpus;
+}
+
+//Number of NUMA nodes, nodes are assumed to be numbered from 0 without gaps
+inline int numaNodeCount()
+{
+    static const int nodes = []()
+    {
+        int n = 0;
+        while (std::ifstream("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist"))
+            n++;
+        return (n > 0) ? n : 1;
+    }();
+    return nodes;
+}
+
+/*
+threadPool is the single pool of worker threads shared by every parallel kernel in the library.
+The number of workers defaults to the hardware concurrency and can be overridden with the
+MATRIX_THREADS environment variable. Tasks are intrusive, so submitting work never allocates.
+Setting MATRIX_PIN=1 pins each worker to one CPU, dealing workers out to the NUMA nodes in turn,
+so that memory placed on a node by first touch or binding stays local to the threads using it.
+*/
+class threadPool
+{
+public:
+    class task
+    {
+        friend class threadPool;
+        friend class taskGroup;
+        task* next;
+        taskGroup* group;
+        asyncState* state;
+    public:
+        task() : next(nullptr), group(nullptr), state(nullptr) {};
+        virtual ~task() {};
+        virtual void run() = 0;
+    };
+
+    static threadPool& instance();
+    ~threadPool();
+    //Number of threads that take part in a parallel loop, including the caller
+    int size()const
+    {
+        return static_cast<int>(workers.size()) + 1;
+    };
+    bool runPending();
+    void post(task* t, asyncState* state);
+    template <class Function>
+    void parallelFor(int begin, int end, int grain, Function function);
+    template <class First, class Second>
+    void parallelInvoke(First first, Second second);
+private:
+    threadPool(int threads);
+    threadPool(const threadPool &);
+    threadPool& operator=(const threadPool &);
+    void submit(task* t);
+    static void push(task* &first, task* &last, task* t);
+    static task* pop(task* &first, task* &last);
+    static void execute(task* t);
+    void workerLoop();
+    void pin(std::thread &worker, int index);
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    //Tasks forked by running kernels, which any thread waiting on a group helps with
+    task* head;
+    task* tail;
+    //Whole operations from post, which only idle workers start
+    task* postedHead;
+    task* postedTail;
+    bool stopping;
+    friend class taskGroup;
+};
+
+/*
+taskGroup tracks a set of tasks submitted to the pool. wait() blocks until every task has finished,
+running queued forked tasks on the calling thread in the mean time so nested parallelism cannot
+deadlock.
+The first exception thrown by a task is rethrown from wait().
+*/
+class taskGroup
+{
+public:
+    taskGroup() : pending(0) {};
+    ~taskGroup()
+    {
+        finish();
+    };
+    void run(threadPool::task* t)
+    {
+        t->group = this;
+        t->state = asyncState::current();
+        pending.fetch_add(1);
+        threadPool::instance().submit(t);
+    };
+    void wait()
+    {
+        finish();
+        if (error)
+        {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    };
+private:
+    friend class threadPool;
+    void finish()
+    {
+        threadPool &pool = threadPool::instance();
+        while (pending.load(std::memory_order_acquire) > 0)
+        {
+            if (!pool.runPending())
+                std::this_thread::yield();
+        }
+    };
+    void fail(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> guard(errorLock);
+        if (!error)
+            error = e;
+    };
+    std::atomic<int> pending;
+    std::mutex errorLock;
+    std::exception_ptr error;
+};
+
+inline threadPool& threadPool::instance()
+{
+    static threadPool pool(0);
+    return pool;
+}
+
+inline threadPool::threadPool(int threads)
+    : head(nullptr), tail(nullptr), postedHead(nullptr), postedTail(nullptr), stopping(false)
+{
+    if (threads <= 0)
+    {
+        const char* env = std::getenv("MATRIX_THREADS");
+        threads = env ? std::atoi(env) : static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if (threads < 1)
+        threads = 1;
+    const char* pinning = std::getenv("MATRIX_PIN");
+    for (int i = 1; i < threads; i++)
+    {
+        workers.push_back(std::thread(&threadPool::workerLoop, this));
+        if (pinning && std::atoi(pinning) > 0)
+            pin(workers.back(), i - 1);
+    }
+}
+
+/*
+Worker index goes to node index mod nodes, and to the (index / nodes)'th CPU of that node.
+Pinning is a hint, if the CPU is not available to the process the worker is left unpinned.
+*/
+inline void threadPool::pin(std::thread &worker, int index)
+{
+    const int nodes = numaNodeCount();
+    std::vector<int> cpus = numaNodeCpus(index % nodes);
+    if (cpus.empty())
+    {
+        cpus.resize(std::thread::hardware_concurrency());
+        for (size_t c = 0; c < cpus.size(); c++)
+            cpus[c] = static_cast<int>(c);
+        if (cpus.empty())
+            return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[(index / nodes) % cpus.size()], &set);
+    pthread_setaffinity_np(worker.native_handle(), sizeof(set), &set);
+}
+
+inline threadPool::~threadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+inline void threadPool::push(task* &first, task* &last, task* t)
+{
+    t->next = nullptr;
+    if (last)
+        last->next = t;
+    else
+        first = t;
+    last = t;
+}
+
+inline threadPool::task* threadPool::pop(task* &first, task* &last)
+{
+    task* t = first;
+    if (t)
+    {
+        first = t->next;
+        if (!first)
+            last = nullptr;
+    }
+    return t;
+}
+
+inline void threadPool::submit(task* t)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        push(head, tail, t);
+    }
+    wake.notify_one();
+}
+
+/*
+Queue a task that belongs to no group, to run as part of the asynchronous operation with the given
+state. Nothing waits for it, so it must report its own result and may delete itself when it is done.
+It goes on a queue of its own that only idle workers take from, so a thread waiting on a parallel
+loop never ends up running a whole operation on its stack. With no workers in the pool it gets a
+thread of its own, so it can never be stranded in the queue.
+*/
+inline void threadPool::post(task* t, asyncState* state)
+{
+    t->group = nullptr;
+    t->state = state;
+    if (workers.empty())
+    {
+        std::thread(&threadPool::execute, t).detach();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        push(postedHead, postedTail, t);
+    }
+    wake.notify_one();
+}
+
+/*
+run a task and report its completion to its group, the group may be destroyed as soon as
+pending reaches zero so nothing may touch the task afterwards
+The task runs with the asynchronous state it was submitted under, and the thread's own is put
+back afterwards, since a thread waiting on one operation may run tasks of another.
+*/
+inline void threadPool::execute(task* t)
+{
+    taskGroup* group = t->group;
+    asyncState* previous = asyncState::current();
+    asyncState::current() = t->state;
+    try
+    {
+        t->run();
+    }
+    catch (...)
+    {
+        if (group)
+            group->fail(std::current_exception());
+    }
+    asyncState::current() = previous;
+    if (group)
+        group->pending.fetch_sub(1, std::memory_order_release);
+}
+
+/*
+Pop one queued forked task and run it on the calling thread, returns false if there was none.
+Posted operations are left for the workers.
+*/
+inline bool threadPool::runPending()
+{
+    task* t = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        t = pop(head, tail);
+    }
+    if (!t)
+        return false;
+    execute(t);
+    return true;
+}
+
+inline void threadPool::workerLoop()
+{
+    for (;;)
+    {
+        task* t = nullptr;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!head && !postedHead && !stopping)
+                wake.wait(guard);
+            //Work already under way is finished before a new operation is started
+            t = pop(head, tail);
+            if (!t)
+                t = pop(postedHead, postedTail);
+            if (!t)
+                return;
+        }
+        execute(t);
+    }
+}
+
+//Worker side of parallelFor, each copy pulls grain sized chunks from a shared counter
+template <class Function>
+class rangeTask : public threadPool::task
+{
+public:
+    Function* function;
+    std::atomic<int>* next;
+    int end;
+    int grain;
+    void run()
+    {
+        for (;;)
+        {
+            int first = next->fetch_add(grain);
+            if (first >= end)
+                return;
+            int last = (end - first > grain) ? first + grain : end;
+            (*function)(first, last);
+        }
+    };
+};
+
+/*
+Call function(first, last) over [begin, end) in chunks of grain, spread across the pool.
+The calling thread takes part in the loop. Small ranges run inline without touching the pool.
+*/
+template <class Function>
+void threadPool::parallelFor(int begin, int end, int grain, Function function)
+{
+    if (grain < 1)
+        grain = 1;
+    int chunks = (end - begin + grain - 1) / grain;
+    if (chunks <= 1 || workers.empty())
+    {
+        for (int first = begin; first < end; first += grain)
+            function(first, (end - first > grain) ? first + grain : end);
+        return;
+    }
+    const int maxHelpers = 64;
+    int helpers = chunks - 1;
+    if (helpers > static_cast<int>(workers.size()))
+        helpers = static_cast<int>(workers.size());
+    if (helpers > maxHelpers)
+        helpers = maxHelpers;
+    std::atomic<int> next(begin);
+    rangeTask<Function> tasks[maxHelpers];
+    taskGroup group;
+    for (int i = 0; i < helpers; i++)
+    {
+        tasks[i].function = &function;
+        tasks[i].next = &next;
+        tasks[i].end = end;
+        tasks[i].grain = grain;
+        group.run(&tasks[i]);
+    }
+    rangeTask<Function> self;
+    self.function = &function;
+    self.next = &next;
+    self.end = end;
+    self.grain = grain;
+    try
+    {
+        self.run();
+    }
+    catch (...)
+    {
+        //stop the helpers picking up new chunks before rethrowing
+        next.store(end);
+        group.finish();
+        throw;
+    }
+    group.wait();
+}
+
+//Worker side of parallelInvoke
+template <class Function>
+class callTask : public threadPool::task
+{
+public:
+    Function* function;
+    void run()
+    {
+        (*function)();
+    };
+};
+
+/*
+Call first() and second() at the same time, first as a task on the pool and second on the calling
+thread, and return once both are done. Either may itself fork, which is how recursive algorithms
+spread their independent halves over the pool.
+*/
+template <class First, class Second>
+void threadPool::parallelInvoke(First first, Second second)
+{
+    if (workers.empty())
+    {
+        first();
+        second();
+        return;
+    }
+    callTask<First> t;
+    t.function = &first;
+    taskGroup group;
+    group.run(&t);
+    second();
+    group.wait();
+}
+
+}
+
+#endif
@@ -0,0 +1,489 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_TILED_H
+#define MATRIX_TILED_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "matrix.h"
+
+namespace Matrix
+{
+
+/*
+tiledMatrix is a dense matrix too big for memory. It is cut into square tiles which live in a
+memory mapped scratch file, and at most a fixed number of tiles are kept resident: touching a
+tile beyond the budget drops the least recently used one back to the file. Tiles are padded
+with zeros to a whole tile, and to a whole number of pages so each can be advised separately.
+The scratch file is created in the given directory and removed as soon as it is mapped, so it
+cannot outlive the process.
+*/
+template <class Type>
+class tiledMatrix
+{
+public:
+    tiledMatrix(int in_width, int in_height, const std::string &scratchDirectory, int in_tile = 256, size_t residentBytes = 512u << 20);
+    ~tiledMatrix();
+    int getWidth()const
+    {
+        return width;
+    };
+    int getHeight()const
+    {
+        return height;
+    };
+    int getTileSize()const
+    {
+        return tile;
+    };
+    int getTileRows()const
+    {
+        return tileRows;
+    };
+    int getTileColumns()const
+    {
+        return tileColumns;
+    };
+    Type* getTile(int ty, int tx);
+    void prefetch(int ty, int tx);
+    Type get(int y, int x);
+    void set(int y, int x, Type value);
+private:
+    tiledMatrix(const tiledMatrix<Type> &);
+    tiledMatrix<Type>& operator=(const tiledMatrix<Type> &);
+    void touch(int id);
+    void evict(int id);
+    int width;
+    int height;
+    int tile;
+    int tileRows;
+    int tileColumns;
+    size_t tileBytes;
+    size_t budget;
+    size_t mappedBytes;
+    char* base;
+    std::list<int> recent;
+    std::vector<std::list<int>::iterator> position;
+    std::vector<bool> resident;
+};
+
+template <class Type>
+tiledMatrix<Type>::tiledMatrix(int in_width, int in_height, const std::string &scratchDirectory, int in_tile, size_t residentBytes)
+    : width(in_width), height(in_height), tile(in_tile), base(nullptr)
+{
+    if (width <= 0 || height <= 0 || tile <= 0)
+        throw matrixException(DIMENSION_ERROR);
+    tileRows = (height + tile - 1) / tile;
+    tileColumns = (width + tile - 1) / tile;
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    tileBytes = (static_cast<size_t>(tile) * tile * sizeof(Type) + page - 1) / page * page;
+    //Blocked algorithms hold a handful of tiles at once, never let the budget starve them
+    budget = residentBytes / tileBytes;
+    if (budget < 8)
+        budget = 8;
+    mappedBytes = tileBytes * tileRows * tileColumns;
+
+    std::string path = scratchDirectory + "/matrix-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if (fd < 0)
+        throw matrixException(IO_ERROR);
+    unlink(name.data());
+    //A sparse file reads back as zeros, which is the padding the algorithms rely on
+    if (ftruncate(fd, static_cast<off_t>(mappedBytes)) != 0)
+    {
+        close(fd);
+        throw matrixException(IO_ERROR);
+    }
+    void* mapped = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw matrixException(MEMORY_ERROR);
+    base = static_cast<char*>(mapped);
+    position.resize(static_cast<size_t>(tileRows) * tileColumns);
+    resident.assign(static_cast<size_t>(tileRows) * tileColumns, false);
+}
+
+template <class Type>
+tiledMatrix<Type>::~tiledMatrix()
+{
+    if (base)
+        munmap(base, mappedBytes);
+    base = nullptr;
+}
+
+//Mark a tile as most recently used, dropping the least recently used one if over budget
+template <class Type>
+void tiledMatrix<Type>::touch(int id)
+{
+    if (resident[id])
+    {
+        recent.splice(recent.begin(), recent, position[id]);
+        return;
+    }
+    recent.push_front(id);
+    position[id] = recent.begin();
+    resident[id] = true;
+    if (recent.size() > budget)
+    {
+        int victim = recent.back();
+        recent.pop_back();
+        resident[victim] = false;
+        evict(victim);
+    }
+}
+
+/*
+Start writing a tile back and release its pages. The mapping is shared, so dirty data is kept
+by the page cache and the tile faults back in from there or from the file when next used.
+*/
+template <class Type>
+void tiledMatrix<Type>::evict(int id)
+{
+    char* start = base + tileBytes * id;
+    msync(start, tileBytes, MS_ASYNC);
+    madvise(start, tileBytes, MADV_DONTNEED);
+}
+
+/*
+Pointer to tile (ty, tx), stored row major with a row length of getTileSize().
+The pointer stays valid for the life of the matrix, the budget only decides which tiles are
+kept in memory.
+*/
+template <class Type>
+Type* tiledMatrix<Type>::getTile(int ty, int tx)
+{
+    if (ty < 0 || ty >= tileRows || tx < 0 || tx >= tileColumns)
+        throw matrixException(BOUNDS_ERROR);
+    int id = ty * tileColumns + tx;
+    touch(id);
+    return reinterpret_cast<Type*>(base + tileBytes * id);
+}
+
+//Ask the kernel to start reading a tile in, so it is ready by the time it is needed
+template <class Type>
+void tiledMatrix<Type>::prefetch(int ty, int tx)
+{
+    if (ty < 0 || ty >= tileRows || tx < 0 || tx >= tileColumns)
+        return;
+    madvise(base + tileBytes * (ty * tileColumns + tx), tileBytes, MADV_WILLNEED);
+}
+
+template <class Type>
+Type tiledMatrix<Type>::get(int y, int x)
+{
+    if (y < 0 || y >= height || x < 0 || x >= width)
+        throw matrixException(BOUNDS_ERROR);
+    return getTile(y / tile, x / tile)[(y % tile) * tile + x % tile];
+}
+
+template <class Type>
+void tiledMatrix<Type>::set(int y, int x, Type value)
+{
+    if (y < 0 || y >= height || x < 0 || x >= width)
+        throw matrixException(BOUNDS_ERROR);
+    getTile(y / tile, x / tile)[(y % tile) * tile + x % tile] = value;
+}
+
+//Tile kernels, every tile is t*t and row major
+namespace tiles
+{
+
+//c += a*b, or c -= a*b when subtract is set, rows of c are shared over the thread pool
+template <class Type>
+void multiplyAdd(const Type* a, const Type* b, Type* c, int t, bool subtract)
+{
+    threadPool::instance().parallelFor(0, t, 16, [=](int first, int last)
+    {
+        for (int y = first; y < last; y++)
+        {
+            const Type* aRow = a + static_cast<size_t>(y) * t;
+            Type* cRow = c + static_cast<size_t>(y) * t;
+            for (int k = 0; k < t; k++)
+            {
+                const Type scale = subtract ? -aRow[k] : aRow[k];
+                if (scale == 0)
+                    continue;
+                const Type* bRow = b + static_cast<size_t>(k) * t;
+                for (int x = 0; x < t; x++)
+                {
+                    cRow[x] += scale * bRow[x];
+                }
+            }
+        }
+    });
+}
+
+//b = L^-1 b, L is the unit lower triangle of l
+template <class Type>
+void solveLower(const Type* l, Type* b, int t)
+{
+    for (int i = 1; i < t; i++)
+    {
+        Type* bRow = b + static_cast<size_t>(i) * t;
+        for (int m = 0; m < i; m++)
+        {
+            const Type f = l[static_cast<size_t>(i) * t + m];
+            if (f == 0)
+                continue;
+            const Type* mRow = b + static_cast<size_t>(m) * t;
+            for (int x = 0; x < t; x++)
+            {
+                bRow[x] -= f * mRow[x];
+            }
+        }
+    }
+}
+
+//b = U^-1 b, U is the upper triangle of u including the diagonal
+template <class Type>
+void solveUpper(const Type* u, Type* b, int t)
+{
+    for (int i = t - 1; i >= 0; i--)
+    {
+        Type* bRow = b + static_cast<size_t>(i) * t;
+        for (int m = i + 1; m < t; m++)
+        {
+            const Type f = u[static_cast<size_t>(i) * t + m];
+            if (f == 0)
+                continue;
+            const Type* mRow = b + static_cast<size_t>(m) * t;
+            for (int x = 0; x < t; x++)
+            {
+                bRow[x] -= f * mRow[x];
+            }
+        }
+        const Type inv = 1 / u[static_cast<size_t>(i) * t + i];
+        for (int x = 0; x < t; x++)
+        {
+            bRow[x] *= inv;
+        }
+    }
+}
+
+//Swap rows r and s across tile column tx of m
+template <class Type>
+void swapRows(tiledMatrix<Type> &m, int tx, int r, int s)
+{
+    const int t = m.getTileSize();
+    Type* rowR = m.getTile(r / t, tx) + static_cast<size_t>(r % t) * t;
+    Type* rowS = m.getTile(s / t, tx) + static_cast<size_t>(s % t) * t;
+    for (int x = 0; x < t; x++)
+    {
+        Type tmp = rowR[x];
+        rowR[x] = rowS[x];
+        rowS[x] = tmp;
+    }
+}
+
+}
+
+/*
+out = a*b for tiled matrices sharing a tile size. Each output tile is built in place from a row
+of tiles of a and a column of tiles of b, and the next pair is prefetched while the current one
+is multiplied, so only three tiles need to be resident at a time.
+*/
+template <class Type>
+void multiply(tiledMatrix<Type> &a, tiledMatrix<Type> &b, tiledMatrix<Type> &out)
+{
+    if (a.getWidth() != b.getHeight() || out.getHeight() != a.getHeight() || out.getWidth() != b.getWidth())
+        throw matrixException(DIMENSION_ERROR);
+    const int t = a.getTileSize();
+    if (b.getTileSize() != t || out.getTileSize() != t)
+        throw matrixException(DIMENSION_ERROR);
+    const int inner = a.getTileColumns();
+    for (int i = 0; i < out.getTileRows(); i++)
+    {
+        for (int j = 0; j < out.getTileColumns(); j++)
+        {
+            Type* c = out.getTile(i, j);
+            for (size_t e = 0; e < static_cast<size_t>(t) * t; e++)
+            {
+                c[e] = 0;
+            }
+            for (int k = 0; k < inner; k++)
+            {
+                a.prefetch(i, k + 1);
+                b.prefetch(k + 1, j);
+                tiles::multiplyAdd(a.getTile(i, k), b.getTile(k, j), out.getTile(i, j), t, false);
+            }
+        }
+    }
+}
+
+/*
+Blocked right looking LU with partial pivoting, done in place: afterwards a holds the unit
+lower factor L below the diagonal and U on and above it, and pivot[r] is the row swapped with r.
+A column of tiles (the panel) is factored in memory, its row swaps are applied to the other
+tile columns, then the block row of U is solved and the trailing tiles updated tile by tile.
+The padding beyond the last row and column is treated as an identity block.
+If the matrix is not square, dimension error is thrown.
+If the matrix is singular, math error is thrown.
+*/
+template <class Type>
+void factor(tiledMatrix<Type> &a, std::vector<int> &pivot)
+{
+    if (a.getWidth() != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    const int t = a.getTileSize();
+    const int nb = a.getTileRows();
+    const int n = nb * t;
+    for (int d = a.getHeight(); d < n; d++)
+    {
+        a.getTile(d / t, d / t)[(d % t) * t + d % t] = 1;
+    }
+    pivot.resize(n);
+    std::vector<Type> panel;
+    for (int k = 0; k < nb; k++)
+    {
+        //Gather tile column k from row k*t down into one contiguous panel
+        const int top = k * t;
+        const int rows = n - top;
+        panel.resize(static_cast<size_t>(rows) * t);
+        for (int i = k; i < nb; i++)
+        {
+            a.prefetch(i + 1, k);
+            const Type* src = a.getTile(i, k);
+            std::copy(src, src + static_cast<size_t>(t) * t, panel.begin() + static_cast<size_t>(i - k) * t * t);
+        }
+        for (int j = 0; j < t; j++)
+        {
+            int p = j;
+            Type best = std::fabs(panel[static_cast<size_t>(j) * t + j]);
+            for (int r = j + 1; r < rows; r++)
+            {
+                Type v = std::fabs(panel[static_cast<size_t>(r) * t + j]);
+                if (v > best)
+                {
+                    best = v;
+                    p = r;
+                }
+            }
+            if (best == 0)
+                throw matrixException(MATH_ERROR);
+            pivot[top + j] = top + p;
+            if (p != j)
+            {
+                std::swap_ranges(panel.begin() + static_cast<size_t>(j) * t, panel.begin() + static_cast<size_t>(j + 1) * t,
+                                 panel.begin() + static_cast<size_t>(p) * t);
+            }
+            Type* pRow = panel.data() + static_cast<size_t>(j) * t;
+            const Type inv = 1 / pRow[j];
+            Type* data = panel.data();
+            threadPool::instance().parallelFor(j + 1, rows, 256, [=](int first, int last)
+            {
+                for (int r = first; r < last; r++)
+                {
+                    Type* row = data + static_cast<size_t>(r) * t;
+                    const Type l = row[j] * inv;
+                    row[j] = l;
+                    for (int x = j + 1; x < t; x++)
+                    {
+                        row[x] -= l * pRow[x];
+                    }
+                }
+            });
+        }
+        for (int i = k; i < nb; i++)
+        {
+            std::copy(panel.begin() + static_cast<size_t>(i - k) * t * t, panel.begin() + static_cast<size_t>(i - k + 1) * t * t, a.getTile(i, k));
+        }
+        //Apply this panel's row swaps to every other tile column
+        for (int j = 0; j < nb; j++)
+        {
+            if (j == k)
+                continue;
+            for (int r = top; r < top + t; r++)
+            {
+                if (pivot[r] != r)
+                    tiles::swapRows(a, j, r, pivot[r]);
+            }
+        }
+        //Block row of U, then the trailing update A_ij -= A_ik * A_kj
+        for (int j = k + 1; j < nb; j++)
+        {
+            tiles::solveLower(a.getTile(k, k), a.getTile(k, j), t);
+            for (int i = k + 1; i < nb; i++)
+            {
+                a.prefetch(i + 1, k);
+                a.prefetch(i + 1, j);
+                tiles::multiplyAdd(a.getTile(i, k), a.getTile(k, j), a.getTile(i, j), t, true);
+            }
+        }
+    }
+}
+
+/*
+Invert a tiled matrix out of core. a is overwritten with its LU factors, and out receives the
+inverse one column of tiles at a time, by forward and back substitution against the permuted
+identity. Each column of tiles streams the factors through memory once.
+If the matrix is not square, dimension error is thrown.
+If the matrix is singular, math error is thrown.
+*/
+template <class Type>
+void invert(tiledMatrix<Type> &a, tiledMatrix<Type> &out)
+{
+    if (out.getWidth() != a.getWidth() || out.getHeight() != a.getHeight() || out.getTileSize() != a.getTileSize())
+        throw matrixException(DIMENSION_ERROR);
+    std::vector<int> pivot;
+    factor(a, pivot);
+    const int t = a.getTileSize();
+    const int nb = a.getTileRows();
+    const int n = nb * t;
+    for (int j = 0; j < nb; j++)
+    {
+        //Column block j of the identity, with the row swaps applied in order
+        for (int i = 0; i < nb; i++)
+        {
+            Type* b = out.getTile(i, j);
+            for (size_t e = 0; e < static_cast<size_t>(t) * t; e++)
+            {
+                b[e] = 0;
+            }
+            if (i == j)
+            {
+                for (int d = 0; d < t; d++)
+                {
+                    b[static_cast<size_t>(d) * t + d] = 1;
+                }
+            }
+        }
+        for (int r = 0; r < n; r++)
+        {
+            if (pivot[r] != r)
+                tiles::swapRows(out, j, r, pivot[r]);
+        }
+        for (int i = 0; i < nb; i++)
+        {
+            for (int m = 0; m < i; m++)
+            {
+                a.prefetch(i, m + 1);
+                tiles::multiplyAdd(a.getTile(i, m), out.getTile(m, j), out.getTile(i, j), t, true);
+            }
+            tiles::solveLower(a.getTile(i, i), out.getTile(i, j), t);
+        }
+        for (int i = nb - 1; i >= 0; i--)
+        {
+            for (int m = i + 1; m < nb; m++)
+            {
+                a.prefetch(i, m + 1);
+                tiles::multiplyAdd(a.getTile(i, m), out.getTile(m, j), out.getTile(i, j), t, true);
+            }
+            tiles::solveUpper(a.getTile(i, i), out.getTile(i, j), t);
+        }
+    }
+}
+
+}
+
+#endif
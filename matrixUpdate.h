@@ -0,0 +1,248 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef MATRIX_UPDATE_H
+#define MATRIX_UPDATE_H
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include "matrix.h"
+#include "matrixLU.h"
+
+namespace Matrix
+{
+
+/*
+inverseUpdater keeps a square matrix and its inverse in step as the matrix changes by low rank
+updates. By the Sherman-Morrison-Woodbury identity
+
+    (A + U V^T)^-1 = A^-1 - A^-1 U (I + V^T A^-1 U)^-1 V^T A^-1
+
+a rank k update costs O(n^2 k) instead of the O(n^3) of inverting again.
+Rounding error builds up over many updates, so after each one the inverse is checked against the
+matrix with a random probe vector, which costs O(n^2). When the backward error of the inverse
+passes tolerance, the inverse is recomputed from scratch by LU. A fresh inverse is kept even if it
+misses tolerance itself, since it is the best there is.
+If the matrix is not square, dimension error is thrown.
+If the matrix, or an update of it, is singular, math error is thrown and the updater is unchanged.
+*/
+class inverseUpdater
+{
+public:
+    template <class Type>
+    explicit inverseUpdater(const matrix<Type> &a, double in_tolerance = 1e-8);
+    const matrix<double>& getMatrix()const
+    {
+        return current;
+    };
+    const matrix<double>& getInverse()const
+    {
+        return inverse;
+    };
+    //Backward error measured after the last update, or of the first inverse
+    double getDrift()const
+    {
+        return drift;
+    };
+    int getUpdates()const
+    {
+        return updates;
+    };
+    int getRefactorizations()const
+    {
+        return refactorizations;
+    };
+    void update(const matrix<double> &u, const matrix<double> &v);
+    void replaceRows(const std::vector<int> &rows, const matrix<double> &values);
+    void replaceColumns(const std::vector<int> &columns, const matrix<double> &values);
+    void replaceRow(int row, const matrix<double> &values);
+    void replaceColumn(int column, const matrix<double> &values);
+    void refactor();
+private:
+    double measureDrift();
+    static void checkIndices(const std::vector<int> &indices, int n);
+    int n;
+    double tolerance;
+    double drift;
+    int updates;
+    int refactorizations;
+    matrix<double> current;
+    matrix<double> inverse;
+    std::mt19937 probes;
+};
+
+template <class Type>
+inverseUpdater::inverseUpdater(const matrix<Type> &a, double in_tolerance)
+    : n(a.getWidth()), tolerance(in_tolerance), drift(0), updates(0), refactorizations(0),
+      current(static_cast<matrix<double> >(a)), probes(0x5eed)
+{
+    if (a.getWidth() != a.getHeight())
+        throw matrixException(DIMENSION_ERROR);
+    inverse = luDecomposition(current).inverse();
+    drift = measureDrift();
+}
+
+//Invert the current matrix from scratch, math error if it is singular
+inline void inverseUpdater::refactor()
+{
+    inverse = luDecomposition(current).inverse();
+    refactorizations++;
+    drift = measureDrift();
+}
+
+/*
+Normwise backward error of the inverse, by schur::residual. Unlike the plain residual this does
+not grow with the condition of A, so a well computed inverse of an ill conditioned matrix still
+passes. A fresh probe each time means no fixed direction of error can hide from the check.
+*/
+inline double inverseUpdater::measureDrift()
+{
+    return schur::residual(current, inverse, probes);
+}
+
+/*
+Bounds error if an index is outside the matrix, dimension error if one is given twice, since the
+same row or column cannot be replaced by two different values at once.
+*/
+inline void inverseUpdater::checkIndices(const std::vector<int> &indices, int n)
+{
+    std::vector<int> sorted(indices);
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        if (sorted[i] < 0 || sorted[i] >= n)
+            throw matrixException(BOUNDS_ERROR);
+        if (i > 0 && sorted[i] == sorted[i - 1])
+            throw matrixException(DIMENSION_ERROR);
+    }
+}
+
+/*
+A = A + U V^T, with U and V both n*k. The k*k capacitance matrix I + V^T A^-1 U is solved by LU,
+and if it is singular so is the updated matrix.
+*/
+inline void inverseUpdater::update(const matrix<double> &u, const matrix<double> &v)
+{
+    const int k = u.getWidth();
+    if (u.getHeight() != n || v.getHeight() != n || v.getWidth() != k)
+        throw matrixException(DIMENSION_ERROR);
+    matrix<double> inverseU = inverse * u;
+    matrix<double> vInverse = transpose(v) * inverse;
+    matrix<double> capacitance = transpose(v) * inverseU;
+    for (int i = 0; i < k; i++)
+    {
+        capacitance(i, i) += 1.0;
+    }
+    matrix<double> correction = inverseU * luDecomposition(capacitance).solve(vInverse);
+    matrix<double> product = u * transpose(v);
+    //The new state is built aside so the old one can be put back if refactoring fails
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            correction(y, x) = inverse(y, x) - correction(y, x);
+            product(y, x) += current(y, x);
+        }
+    }
+    const double previousDrift = drift;
+    const int previousRefactorizations = refactorizations;
+    inverse.swap(correction);
+    current.swap(product);
+    drift = measureDrift();
+    if (!(drift <= tolerance))
+    {
+        try
+        {
+            refactor();
+            //An inverse that overflowed is no inverse at all
+            if (!std::isfinite(drift))
+                throw matrixException(MATH_ERROR);
+        }
+        catch (...)
+        {
+            inverse.swap(correction);
+            current.swap(product);
+            drift = previousDrift;
+            refactorizations = previousRefactorizations;
+            throw;
+        }
+    }
+    updates++;
+}
+
+/*
+Replace rows of A, values holds one new row per entry of rows (k rows of width n), and each row
+may be given only once.
+As an update, U is the matching columns of the identity and V^T the change in each row.
+*/
+inline void inverseUpdater::replaceRows(const std::vector<int> &rows, const matrix<double> &values)
+{
+    const int k = static_cast<int>(rows.size());
+    if (values.getHeight() != k || values.getWidth() != n)
+        throw matrixException(DIMENSION_ERROR);
+    checkIndices(rows, n);
+    matrix<double> u(k, n), v(k, n);
+    for (int y = 0; y < n; y++)
+    {
+        for (int i = 0; i < k; i++)
+        {
+            u(y, i) = 0.0;
+        }
+    }
+    for (int i = 0; i < k; i++)
+    {
+        u(rows[i], i) = 1.0;
+        for (int x = 0; x < n; x++)
+        {
+            v(x, i) = values(i, x) - current(rows[i], x);
+        }
+    }
+    update(u, v);
+}
+
+/*
+Replace columns of A, values holds one new column per entry of columns (n rows of width k), and
+each column may be given only once.
+As an update, U is the change in each column and V the matching columns of the identity.
+*/
+inline void inverseUpdater::replaceColumns(const std::vector<int> &columns, const matrix<double> &values)
+{
+    const int k = static_cast<int>(columns.size());
+    if (values.getWidth() != k || values.getHeight() != n)
+        throw matrixException(DIMENSION_ERROR);
+    checkIndices(columns, n);
+    matrix<double> u(k, n), v(k, n);
+    for (int y = 0; y < n; y++)
+    {
+        for (int i = 0; i < k; i++)
+        {
+            v(y, i) = 0.0;
+        }
+    }
+    for (int i = 0; i < k; i++)
+    {
+        v(columns[i], i) = 1.0;
+        for (int y = 0; y < n; y++)
+        {
+            u(y, i) = values(y, i) - current(y, columns[i]);
+        }
+    }
+    update(u, v);
+}
+
+inline void inverseUpdater::replaceRow(int row, const matrix<double> &values)
+{
+    replaceRows(std::vector<int>(1, row), values);
+}
+
+inline void inverseUpdater::replaceColumn(int column, const matrix<double> &values)
+{
+    replaceColumns(std::vector<int>(1, column), values);
+}
+
+}
+
+#endif
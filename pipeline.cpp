@@ -0,0 +1,295 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include "matrix.h"
+#include "pipeline.h"
+
+namespace {
+
+typedef std::chrono::steady_clock stageClock;
+
+const size_t blockSize = 1 << 20;
+const size_t blockQueueDepth = 8;
+const size_t batchQueueDepth = 4;
+
+/*
+Matrices travel between stages in batches of roughly batchElements numbers, so small matrices
+do not pay a queue hand-off each
+*/
+const size_t batchElements = 1 << 16;
+
+struct parsedBatch {
+    int first;
+    int matrices;
+    std::vector<double> values;
+};
+
+struct invertedBatch {
+    int first;
+    std::vector<std::unique_ptr<Matrix::matrix<double> > > inverses;
+    std::vector<std::string> errors;
+};
+
+struct formattedBatch {
+    int first;
+    std::vector<std::string> texts;
+    std::vector<bool> failed;
+};
+
+//Accumulates the time a stage spends working, as opposed to waiting on its queues
+class stageTimer {
+public:
+    stageTimer() : busy(0) {}
+    void start(){
+        began = stageClock::now();
+    }
+    void stop(){
+        busy += std::chrono::duration<double, std::milli>(stageClock::now() - began).count();
+    }
+    double milliseconds()const{
+        return busy;
+    }
+private:
+    stageClock::time_point began;
+    double busy;
+};
+
+/*
+Read raw blocks from the input. Each block is cut at its last white space and the tail carried
+into the next one, so the parser never sees a number split across two blocks.
+*/
+void readStage(std::istream &input, boundedQueue<std::string> &blocks, stageTimer &timer){
+    std::string carry;
+    std::vector<char> buffer(blockSize);
+    for (;;){
+        timer.start();
+        input.read(buffer.data(), buffer.size());
+        size_t got = static_cast<size_t>(input.gcount());
+        std::string block;
+        block.swap(carry);
+        block.append(buffer.data(), got);
+        bool end = (got < buffer.size());
+        if (!end){
+            size_t cut = block.find_last_of(" \t\r\n\v\f");
+            if (cut != std::string::npos){
+                carry.assign(block, cut + 1, std::string::npos);
+                block.resize(cut + 1);
+            }
+        }
+        timer.stop();
+        if (!block.empty() && !blocks.push(std::move(block))){
+            break;
+        }
+        if (end){
+            break;
+        }
+    }
+    blocks.close();
+}
+
+/*
+Turn blocks of text into batches of dim*dim element arrays. Like reading with an istream_iterator,
+the first thing that is not a number ends the input. A trailing partial matrix is padded with
+zeros, as the matrix constructor would, and an empty input still yields one (all zero) matrix.
+*/
+void parseStage(boundedQueue<std::string> &blocks, boundedQueue<parsedBatch> &batches, int dim, int count, stageTimer &timer){
+    const size_t elements = static_cast<size_t>(dim) * dim;
+    const int perBatch = (elements >= batchElements) ? 1 : static_cast<int>(batchElements / elements);
+    parsedBatch current;
+    current.first = 0;
+    current.matrices = 0;
+    current.values.reserve(elements * perBatch);
+    int parsed = 0;
+    bool finished = false;
+    std::string block;
+    while (!finished && blocks.pop(block)){
+        timer.start();
+        const char* p = block.c_str();
+        for (;;){
+            while (std::isspace(static_cast<unsigned char>(*p))){
+                p++;
+            }
+            if (!*p){
+                break;
+            }
+            char* end;
+            double value = std::strtod(p, &end);
+            if (end == p){
+                finished = true;
+                break;
+            }
+            p = end;
+            current.values.push_back(value);
+            if (current.values.size() % elements == 0){
+                current.matrices++;
+                parsed++;
+                if (count > 0 && parsed >= count){
+                    finished = true;
+                    break;
+                }
+                if (current.matrices == perBatch){
+                    timer.stop();
+                    if (!batches.push(std::move(current))){
+                        finished = true;
+                        break;
+                    }
+                    timer.start();
+                    current.first = parsed;
+                    current.matrices = 0;
+                    current.values.clear();
+                    current.values.reserve(elements * perBatch);
+                }
+            }
+        }
+        timer.stop();
+    }
+    //Stop the reader if we finished before it did
+    blocks.close();
+    if (current.values.size() % elements != 0 || parsed == 0){
+        current.values.resize((current.matrices + 1) * elements, 0.0);
+        current.matrices++;
+    }
+    if (current.matrices > 0){
+        batches.push(std::move(current));
+    }
+    batches.close();
+}
+
+//structures, if given, counts the shape of each matrix for the stats report
+void invertStage(boundedQueue<parsedBatch> &batches, boundedQueue<invertedBatch> &results, int dim, stageTimer &timer, std::map<std::string, int>* structures){
+    const size_t elements = static_cast<size_t>(dim) * dim;
+    std::vector<double> values;
+    parsedBatch batch;
+    while (batches.pop(batch)){
+        timer.start();
+        invertedBatch result;
+        result.first = batch.first;
+        result.inverses.resize(batch.matrices);
+        result.errors.resize(batch.matrices);
+        for (int m = 0; m < batch.matrices; m++){
+            values.assign(batch.values.begin() + m * elements, batch.values.begin() + (m + 1) * elements);
+            try {
+                Matrix::matrix<double> A(dim, dim, &values);
+                if (structures){
+                    (*structures)[Matrix::structure::describe(Matrix::structure::detect(A.getData(), A.getStride(), dim))]++;
+                }
+                result.inverses[m].reset(new Matrix::matrix<double>(Matrix::invert(A)));
+            } catch (Matrix::matrixException e){
+                result.errors[m] = e.getErrorMessage();
+            }
+        }
+        timer.stop();
+        if (!results.push(std::move(result))){
+            break;
+        }
+    }
+    results.close();
+}
+
+void formatStage(boundedQueue<invertedBatch> &results, boundedQueue<formattedBatch> &texts, std::streamsize precision, stageTimer &timer){
+    std::ostringstream out;
+    out.precision(precision);
+    invertedBatch result;
+    while (results.pop(result)){
+        timer.start();
+        formattedBatch text;
+        text.first = result.first;
+        text.texts.resize(result.inverses.size());
+        text.failed.resize(result.inverses.size());
+        for (size_t m = 0; m < result.inverses.size(); m++){
+            text.failed[m] = !result.inverses[m];
+            if (text.failed[m]){
+                text.texts[m].swap(result.errors[m]);
+            } else {
+                out.str(std::string());
+                out << *result.inverses[m];
+                text.texts[m] = out.str();
+            }
+        }
+        timer.stop();
+        if (!texts.push(std::move(text))){
+            break;
+        }
+    }
+    texts.close();
+}
+
+//Errors go to the terminal, as they always have, even when the matrices go to a file
+void writeStage(boundedQueue<formattedBatch> &texts, std::ostream &output, stageTimer &timer, int &written){
+    formattedBatch text;
+    while (texts.pop(text)){
+        timer.start();
+        for (size_t m = 0; m < text.texts.size(); m++){
+            if (text.first + m > 0){
+                output << '\n';
+            }
+            if (text.failed[m]){
+                output.flush();
+                std::cout << text.texts[m] << std::endl;
+            } else {
+                output << text.texts[m];
+            }
+            written++;
+        }
+        timer.stop();
+    }
+    output.flush();
+}
+
+}
+
+int runPipeline(std::istream &input, std::ostream &output, int dim, int count, bool stats){
+    stageClock::time_point began = stageClock::now();
+    boundedQueue<std::string> blocks(blockQueueDepth);
+    boundedQueue<parsedBatch> batches(batchQueueDepth);
+    boundedQueue<invertedBatch> results(batchQueueDepth);
+    boundedQueue<formattedBatch> texts(batchQueueDepth);
+    stageTimer readTimer, parseTimer, invertTimer, formatTimer, writeTimer;
+    int written = 0;
+    std::map<std::string, int> structures;
+
+    std::thread reader(readStage, std::ref(input), std::ref(blocks), std::ref(readTimer));
+    std::thread parser(parseStage, std::ref(blocks), std::ref(batches), dim, count, std::ref(parseTimer));
+    std::thread inverter(invertStage, std::ref(batches), std::ref(results), dim, std::ref(invertTimer), stats ? &structures : nullptr);
+    std::thread formatter(formatStage, std::ref(results), std::ref(texts), output.precision(), std::ref(formatTimer));
+    writeStage(texts, output, writeTimer, written);
+    formatter.join();
+    inverter.join();
+    parser.join();
+    reader.join();
+
+    if (stats){
+        double wall = std::chrono::duration<double, std::milli>(stageClock::now() - began).count();
+        //One shape is named alone, a mix is listed with counts
+        std::string shapes;
+        for (std::map<std::string, int>::const_iterator it = structures.begin(); it != structures.end(); ++it){
+            if (!shapes.empty()){
+                shapes += ", ";
+            }
+            if (structures.size() > 1){
+                shapes += std::to_string(it->second) + " ";
+            }
+            shapes += it->first;
+        }
+        std::cerr << "matrices: " << written << "\n"
+            << "structure: " << shapes << "\n"
+            << "read:     " << readTimer.milliseconds() << " ms\n"
+            << "parse:    " << parseTimer.milliseconds() << " ms\n"
+            << "invert:   " << invertTimer.milliseconds() << " ms\n"
+            << "format:   " << formatTimer.milliseconds() << " ms\n"
+            << "write:    " << writeTimer.milliseconds() << " ms\n"
+            << "wall:     " << wall << " ms" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/*
+boundedQueue hands items from one pipeline stage to the next. push blocks while the queue is
+full, which is what gives the pipeline back-pressure: a fast stage can only get capacity items
+ahead of a slow one. close() wakes everyone, after which push fails and pop drains what is left.
+*/
+template <class Item>
+class boundedQueue {
+public:
+    explicit boundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    bool push(Item item){
+        std::unique_lock<std::mutex> guard(lock);
+        while (items.size() >= capacity && !closed){
+            notFull.wait(guard);
+        }
+        if (closed){
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(Item &item){
+        std::unique_lock<std::mutex> guard(lock);
+        while (items.empty() && !closed){
+            notEmpty.wait(guard);
+        }
+        if (items.empty()){
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close(){
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+private:
+    size_t capacity;
+    bool closed;
+    std::deque<Item> items;
+    std::mutex lock;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+/*
+Invert count dim*dim matrices read back to back from input (count 0 reads until the input runs
+out) and write them to output, separated by blank lines, at output's precision.
+Reading, parsing, inversion, formatting and writing each run on their own thread connected by
+bounded queues, so on a long input the wall time approaches that of the slowest stage.
+If stats is set, the time each stage spent busy is reported on stderr.
+*/
+int runPipeline(std::istream &input, std::ostream &output, int dim, int count, bool stats);
+
+#endif
@@ -0,0 +1,323 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <limits>
+#include <exception>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "matrixLU.h"
+#include "server.h"
+
+/*
+Protocol, one request at a time, numbers separated by any white space:
+    invert <n>              followed by the n*n elements of A
+    determinant <n>         followed by the n*n elements of A
+    solve <n> <k>           followed by the n*n elements of A then the n*k elements of B
+    stats
+    quit
+n and k may be at most 16384.
+A successful reply is "ok <rows> <cols> <cached|factored>" followed by the result, one row per
+line. A failed request gets a single line "error <message>".
+*/
+
+namespace {
+
+typedef std::shared_ptr<const Matrix::luDecomposition> factorPtr;
+
+//Largest n or k a request may give, which bounds the memory one request can ask for
+const int maxDimension = 16384;
+
+//64 bit FNV-1a over the dimension and the raw bytes of the elements
+uint64_t hashMatrix(int n, const double* values, size_t count){
+    uint64_t h = 14695981039346656037ULL;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&n);
+    for (size_t i = 0; i < sizeof(n); i++){
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    bytes = reinterpret_cast<const unsigned char*>(values);
+    for (size_t i = 0; i < count * sizeof(double); i++){
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+LRU cache of factorizations. Entries keep a copy of the matrix they were built from, so a hash
+collision is caught by comparing contents rather than returning the wrong factorization.
+*/
+class factorCache {
+public:
+    explicit factorCache(int capacity) : capacity(capacity), hits(0), misses(0) {}
+
+    factorPtr find(uint64_t key, int n, const std::vector<double> &values){
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = index.find(key);
+        if (it == index.end() || it->second->n != n || it->second->values != values){
+            misses++;
+            return factorPtr();
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        hits++;
+        return it->second->factor;
+    }
+
+    void insert(uint64_t key, int n, const std::vector<double> &values, factorPtr factor){
+        if (capacity <= 0){
+            return;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = index.find(key);
+        if (it != index.end()){
+            entries.erase(it->second);
+            index.erase(it);
+        }
+        entries.push_front(entry{key, n, values, factor});
+        index[key] = entries.begin();
+        while (static_cast<int>(entries.size()) > capacity){
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+    std::string stats(){
+        std::lock_guard<std::mutex> guard(lock);
+        return "hits " + std::to_string(hits) + " misses " + std::to_string(misses) +
+            " entries " + std::to_string(entries.size()) + " capacity " + std::to_string(capacity);
+    }
+private:
+    struct entry {
+        uint64_t key;
+        int n;
+        std::vector<double> values;
+        factorPtr factor;
+    };
+    int capacity;
+    unsigned long hits;
+    unsigned long misses;
+    std::list<entry> entries;
+    std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+    std::mutex lock;
+};
+
+//streambuf over a file descriptor, so a socket can be served with the same code as stdin
+class fdBuffer : public std::streambuf {
+public:
+    explicit fdBuffer(int fd) : fd(fd){
+        setg(input, input, input);
+        setp(output, output + sizeof(output));
+    }
+    ~fdBuffer(){
+        sync();
+    }
+protected:
+    int underflow(){
+        ssize_t got;
+        do {
+            got = read(fd, input, sizeof(input));
+        } while (got < 0 && errno == EINTR);
+        if (got <= 0){
+            return traits_type::eof();
+        }
+        setg(input, input, input + got);
+        return traits_type::to_int_type(*gptr());
+    }
+    int overflow(int c){
+        if (sync() != 0){
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(c, traits_type::eof())){
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    int sync(){
+        char* p = pbase();
+        while (p < pptr()){
+            ssize_t sent = write(fd, p, pptr() - p);
+            if (sent < 0 && errno == EINTR){
+                continue;
+            }
+            if (sent <= 0){
+                return -1;
+            }
+            p += sent;
+        }
+        setp(output, output + sizeof(output));
+        return 0;
+    }
+private:
+    int fd;
+    char input[1 << 16];
+    char output[1 << 16];
+};
+
+//Read count numbers into values, reusing its storage from earlier requests
+bool readValues(std::istream &in, std::vector<double> &values, size_t count){
+    values.resize(count);
+    for (size_t i = 0; i < count; i++){
+        if (!(in >> values[i])){
+            return false;
+        }
+    }
+    return true;
+}
+
+void replyError(std::ostream &out, std::string message){
+    for (size_t i = 0; i < message.size(); i++){
+        if (message[i] == '\n' || message[i] == '\t'){
+            message[i] = ' ';
+        }
+    }
+    out << "error " << message << std::endl;
+}
+
+/*
+Serve requests from one stream until it ends, sends quit or can no longer be written to.
+The element buffers live for the whole session so steady traffic does not reallocate them.
+*/
+void serveStream(std::istream &in, std::ostream &out, factorCache &cache, int precision){
+    std::string command;
+    std::vector<double> values;
+    std::vector<double> rhs;
+    out.precision(precision);
+    while (out && in >> command){
+        if (command == "quit"){
+            break;
+        }
+        if (command == "stats"){
+            out << "ok " << cache.stats() << std::endl;
+            continue;
+        }
+        if (command != "invert" && command != "determinant" && command != "solve"){
+            replyError(out, "unknown command " + command);
+            in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            continue;
+        }
+        int n = 0, k = 0;
+        in >> n;
+        if (command == "solve"){
+            in >> k;
+        }
+        if (!in || n < 1 || k < 0 || n > maxDimension || k > maxDimension){
+            replyError(out, "invalid dimensions for " + command);
+            return;
+        }
+        try {
+            if (!readValues(in, values, static_cast<size_t>(n) * n) ||
+                (command == "solve" && !readValues(in, rhs, static_cast<size_t>(n) * k))){
+                replyError(out, "not enough elements for " + command);
+                return;
+            }
+            uint64_t key = hashMatrix(n, values.data(), values.size());
+            factorPtr factor = cache.find(key, n, values);
+            bool cached = static_cast<bool>(factor);
+            if (!cached){
+                Matrix::matrix<double> A(n, n, &values);
+                try {
+                    factor = std::make_shared<Matrix::luDecomposition>(A);
+                } catch (const Matrix::matrixException &e){
+                    //A singular matrix has no inverse, but its determinant is simply 0
+                    if (command != "determinant" || e.getErrorCode() != Matrix::MATH_ERROR){
+                        throw;
+                    }
+                    out << "ok 1 1 factored\n" << 0.0 << std::endl;
+                    continue;
+                }
+                cache.insert(key, n, values, factor);
+            }
+            const char* origin = cached ? "cached" : "factored";
+            if (command == "determinant"){
+                out << "ok 1 1 " << origin << '\n' << factor->determinant() << std::endl;
+            } else if (command == "invert"){
+                out << "ok " << n << ' ' << n << ' ' << origin << '\n' << factor->inverse();
+                out.flush();
+            } else {
+                Matrix::matrix<double> B(k, n, &rhs);
+                out << "ok " << n << ' ' << k << ' ' << origin << '\n' << factor->solve(B);
+                out.flush();
+            }
+        } catch (const Matrix::matrixException &e){
+            replyError(out, e.getErrorMessage());
+        } catch (const std::exception &e){
+            //Out of memory for one request should not take down the other connections
+            replyError(out, e.what());
+            return;
+        }
+    }
+}
+
+void serveConnection(int fd, factorCache* cache, int precision){
+    {
+        fdBuffer buffer(fd);
+        std::istream in(&buffer);
+        std::ostream out(&buffer);
+        serveStream(in, out, *cache, precision);
+    }
+    close(fd);
+}
+
+int serveSocket(const std::string &path, factorCache &cache, int precision){
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)){
+        std::cout << "socket path is too long: " << path << std::endl;
+        return 1;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0){
+        std::cout << "could not create socket: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 64) < 0){
+        std::cout << "could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+        close(listener);
+        return 1;
+    }
+    for (;;){
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0){
+            if (errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            std::cout << "accept failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        std::thread(serveConnection, fd, &cache, precision).detach();
+    }
+    close(listener);
+    unlink(path.c_str());
+    return 1;
+}
+
+}
+
+int runServer(const std::string &endpoint, int precision, int cacheEntries){
+    static factorCache cache(cacheEntries);
+    //A client that hangs up mid reply must only end its own connection, as EPIPE from write
+    std::signal(SIGPIPE, SIG_IGN);
+    if (endpoint == "-"){
+        std::ios::sync_with_stdio(false);
+        serveStream(std::cin, std::cout, cache, precision);
+        return 0;
+    }
+    return serveSocket(endpoint, cache, precision);
+}
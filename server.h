@@ -0,0 +1,20 @@
+/*
+Written by Andrew M. Hall
+*/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+
+/*
+Run invert-matrix as a long lived server instead of a one shot command.
+An endpoint of "-" serves a single session over stdin/stdout, anything else is taken as the path
+of a Unix domain socket which accepts any number of concurrent connections.
+Factorizations are kept in an LRU cache of cacheEntries matrices keyed by their contents, so a
+repeated matrix, or a new right hand side for a known matrix, is not factored again.
+Returns the process exit code.
+*/
+int runServer(const std::string &endpoint, int precision, int cacheEntries);
+
+#endif